@@ -17,39 +17,353 @@ void EthercatMaster::inc_period(struct period_info *pinfo)
     }
 }
 
-void EthercatMaster::periodic_task_init(struct period_info *pinfo)
+void EthercatMaster::periodic_task_init(struct period_info *pinfo, long period_ns)
 {
-    /* for simplicity, hardcoding a 1ms period */
-    pinfo->period_ns = 1000000;
+    pinfo->period_ns = period_ns;
 
-    clock_gettime(CLOCK_MONOTONIC, &(pinfo->next_period));
+    // Last grid point, the first cycle runs right away and the next one on the grid
+    int64_t now_ns = monotonic_ns();
+    int64_t release_ns = now_ns - now_ns % period_ns;
+    pinfo->next_period.tv_sec = release_ns / 1000000000;
+    pinfo->next_period.tv_nsec = release_ns % 1000000000;
 }
 
 void EthercatMaster::wait_rest_of_period(struct period_info *pinfo)
 {
-    inc_period(pinfo);
+#ifdef ECAT_SIMULATION
+    if (lockstep || systemStateDataPtr->simulation_mode)
+    {
+        wait_lockstep(pinfo);
+        return;
+    }
+    if (freeRun)
+    {
+        // The simulated drives advance by one period per frame, not by the
+        // clock. Yield so the safety controller and planner, same priority, get
+        // their turn on this cycle's feedback.
+        sched_yield();
+        clock_gettime(CLOCK_MONOTONIC, &pinfo->next_period);
+        return;
+    }
+#endif
+    cycleMonitor.advance(pinfo->next_period, pinfo->period_ns);
 
     /* for simplicity, ignoring possibilities of signal wakes */
     clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pinfo->next_period, NULL);
 }
 
+#ifdef ECAT_SIMULATION
+// Lockstep simulation: the safety controller has to finish the cycle just
+// signalled before lockstep_driver hears that it is done, and the next cycle
+// only starts on the driver's next tick, at its virtual time. The simulated
+// drives count frames, not wall-clock time, so runs repeat bit for bit.
+void EthercatMaster::wait_lockstep(struct period_info *pinfo)
+{
+    // An in-process safety controller (instrument_rt) has finished the cycle already
+    if (!cycleStage && !systemStateDataPtr->safety_cycle.waitFor(masterCycleSignaled, exitFlag))
+    {
+        return;
+    }
+
+    if (!lockstep)
+    {
+        lockstep = true;
+        lockstepTickSeen = systemStateDataPtr->lockstep_tick.current();
+        systemStateDataPtr->lockstep_joined.set();
+        rtLog.info("Joined lockstep simulation");
+    }
+    else
+    {
+        systemStateDataPtr->lockstep_done.acknowledge(lockstepTickSeen);
+    }
+
+    if (!systemStateDataPtr->lockstep_tick.waitPast(lockstepTickSeen, exitFlag))
+    {
+        return;
+    }
+    lockstepTickSeen = systemStateDataPtr->lockstep_tick.current();
+
+    int64_t virtual_time_ns = systemStateDataPtr->virtual_time_ns;
+    pinfo->next_period.tv_sec = virtual_time_ns / 1000000000;
+    pinfo->next_period.tv_nsec = virtual_time_ns % 1000000000;
+}
+#endif
+
+// Has to run after ecrt_master_receive() and before ecrt_master_send(). Until the
+// reference clock answers it is aligned to the application time, afterwards
+// the master follows the reference clock: the phase error of the previous
+// cycle feeds a PI loop that moves the next wake-up, while the application
+// time stays on the nominal grid.
+void EthercatMaster::sync_distributed_clocks(struct period_info *pinfo)
+{
+    uint32_t reference_time;
+    bool reference_valid = ecrt_master_reference_clock_time(master, &reference_time) == 0;
+
+    systemStateDataPtr->dc_slave_deviation_ns = ecrt_master_sync_monitor_process(master);
+
+    if (dcReferenceFollowsMaster)
+    {
+        // Several lines: the reference clock of every line is steered to the
+        // common grid instead of each master following its own reference clock
+        if (reference_valid && dcPrevAppTimeNs != 0)
+        {
+            systemStateDataPtr->dc_sync_error_ns = (int32_t)((uint32_t)dcPrevAppTimeNs - reference_time);
+        }
+        ecrt_master_sync_reference_clock_to(master, dcAppTimeNs);
+    }
+    else if (!dcStarted)
+    {
+        ecrt_master_sync_reference_clock(master);
+        dcStarted = reference_valid && reference_time != 0;
+        dcIntegralNs = 0;
+    }
+    else if (reference_valid)
+    {
+        // The reference time was latched by last cycle's frame, fold the
+        // 32 bit difference into +-period/2
+        int64_t error_ns = (int32_t)((uint32_t)dcPrevAppTimeNs - reference_time);
+        error_ns = ((error_ns + pinfo->period_ns / 2) % pinfo->period_ns + pinfo->period_ns) % pinfo->period_ns - pinfo->period_ns / 2;
+        systemStateDataPtr->dc_sync_error_ns = error_ns;
+
+        int64_t max_correction_ns = pinfo->period_ns / DC_MAX_CORRECTION_DIVISOR;
+        dcIntegralNs = std::clamp(dcIntegralNs + error_ns, -max_correction_ns / DC_KI, max_correction_ns / DC_KI);
+        int64_t correction_ns = std::clamp((int64_t)(DC_KP * error_ns + DC_KI * dcIntegralNs), -max_correction_ns, max_correction_ns);
+
+        // Application time ahead of the reference clock: wake up later
+        pinfo->next_period.tv_nsec += correction_ns;
+        while (pinfo->next_period.tv_nsec < 0)
+        {
+            pinfo->next_period.tv_sec--;
+            pinfo->next_period.tv_nsec += 1000000000;
+        }
+        dcAppTimeOffsetNs -= correction_ns;
+    }
+
+    dcPrevAppTimeNs = dcAppTimeNs;
+    ecrt_master_sync_slave_clocks(master);
+    ecrt_master_sync_monitor_queue(master);
+}
+
+static int sdo_size_index(uint8_t size)
+{
+    return size == 1 ? 0 : (size == 2 ? 1 : 2);
+}
+
+// Advances the SDO transfers by at most one step per joint and cycle: finish
+// the running transfer if the mailbox is done with it, otherwise start the
+// oldest pending request. Only non-blocking request calls, never a wait.
+void EthercatMaster::process_sdo_requests()
+{
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
+    {
+        int slot_index = sdoActiveSlot[jnt_ctr];
+        if (slot_index >= 0)
+        {
+            SdoSlot &slot = sdoQueuePtr->slots[slot_index];
+            ec_sdo_request_t *request = sdoRequest[jnt_ctr][sdo_size_index(slot.size)];
+
+            switch (ecrt_sdo_request_state(request))
+            {
+            case EC_REQUEST_SUCCESS:
+                if (!slot.write)
+                {
+                    uint8_t *data = ecrt_sdo_request_data(request);
+                    slot.value = slot.size == 1 ? EC_READ_U8(data) : (slot.size == 2 ? EC_READ_U16(data) : EC_READ_U32(data));
+                }
+                slot.state.store(SdoSlotState::DONE, std::memory_order_release);
+                sdoActiveSlot[jnt_ctr] = -1;
+                break;
+            case EC_REQUEST_ERROR:
+                rtLog.warn("SDO %s 0x%04X:%02X on drive %d failed", slot.write ? "write" : "read", slot.index, slot.subindex, jnt_ctr);
+                slot.state.store(SdoSlotState::FAILED, std::memory_order_release);
+                sdoActiveSlot[jnt_ctr] = -1;
+                break;
+            default:
+                break; // still busy
+            }
+            continue;
+        }
+
+        slot_index = sdoQueuePtr->nextPending(jnt_ctr);
+        if (slot_index < 0)
+        {
+            continue;
+        }
+
+        SdoSlot &slot = sdoQueuePtr->slots[slot_index];
+        if (sdoRequest[jnt_ctr][0] == nullptr)
+        {
+            // The client would wait for it forever and never free the slot
+            rtLog.warn("SDO %s 0x%04X:%02X on drive %d failed, the drive has no SDO request", slot.write ? "write" : "read", slot.index, slot.subindex, jnt_ctr);
+            slot.state.store(SdoSlotState::FAILED, std::memory_order_release);
+            continue;
+        }
+
+        ec_sdo_request_t *request = sdoRequest[jnt_ctr][sdo_size_index(slot.size)];
+        slot.state.store(SdoSlotState::BUSY, std::memory_order_relaxed);
+        ecrt_sdo_request_index(request, slot.index, slot.subindex);
+
+        if (slot.write)
+        {
+            uint8_t *data = ecrt_sdo_request_data(request);
+            switch (slot.size)
+            {
+            case 1:
+                EC_WRITE_U8(data, slot.value);
+                break;
+            case 2:
+                EC_WRITE_U16(data, slot.value);
+                break;
+            default:
+                EC_WRITE_U32(data, slot.value);
+                break;
+            }
+            ecrt_sdo_request_write(request);
+        }
+        else
+        {
+            ecrt_sdo_request_read(request);
+        }
+        sdoActiveSlot[jnt_ctr] = slot_index;
+    }
+
+    // Same for requests to drives that are not on the bus
+    for (int jnt_ctr = numJoints; jnt_ctr < MAX_JOINTS; jnt_ctr++)
+    {
+        int slot_index = sdoQueuePtr->nextPending(jnt_ctr);
+        if (slot_index >= 0)
+        {
+            SdoSlot &slot = sdoQueuePtr->slots[slot_index];
+            rtLog.warn("SDO %s 0x%04X:%02X on drive %d failed, the drive is not on the bus", slot.write ? "write" : "read", slot.index, slot.subindex, jnt_ctr);
+            slot.state.store(SdoSlotState::FAILED, std::memory_order_release);
+        }
+    }
+}
+
+// Once per DIAGNOSTICS_PERIOD_NS: collects the diagnostics reads the mailbox
+// finished and starts the next ones. A read still busy is left running. The
+// error code of a fault is reported from the first read started after it.
+void EthercatMaster::process_diagnostics()
+{
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
+    {
+        for (int object_ctr = 0; object_ctr < NUM_DIAGNOSTIC_OBJECTS; object_ctr++)
+        {
+            ec_sdo_request_t *request = diagnosticsRequest[jnt_ctr][object_ctr];
+            if (request == nullptr)
+            {
+                continue;
+            }
+
+            ec_request_state_t state = ecrt_sdo_request_state(request);
+            if (state == EC_REQUEST_BUSY)
+            {
+                continue;
+            }
+
+            if (state == EC_REQUEST_SUCCESS)
+            {
+                uint8_t *data = ecrt_sdo_request_data(request);
+                switch (DIAGNOSTIC_OBJECTS[object_ctr].index)
+                {
+                case 0x6061:
+                    diagnostics[jnt_ctr].mode_of_operation_display = EC_READ_S8(data);
+                    break;
+                case 0x603F:
+                    diagnostics[jnt_ctr].error_code = EC_READ_U16(data);
+                    if (faultCodeRequested[jnt_ctr])
+                    {
+                        rtLog.error("Drive %d is in fault, error code 0x%04X", jnt_ctr, diagnostics[jnt_ctr].error_code);
+                        faultCodePending[jnt_ctr] = false;
+                    }
+                    break;
+                case 0x6078:
+                    diagnostics[jnt_ctr].current_actual_value = EC_READ_S16(data);
+                    break;
+                }
+            }
+            else if (state == EC_REQUEST_ERROR && DIAGNOSTIC_OBJECTS[object_ctr].index == 0x603F && faultCodeRequested[jnt_ctr])
+            {
+                rtLog.error("Drive %d is in fault, reading the error code failed", jnt_ctr);
+                faultCodePending[jnt_ctr] = false;
+            }
+
+            if (DIAGNOSTIC_OBJECTS[object_ctr].index == 0x603F)
+            {
+                faultCodeRequested[jnt_ctr] = faultCodePending[jnt_ctr];
+            }
+            ecrt_sdo_request_read(request);
+        }
+    }
+}
+
 void EthercatMaster::cyclicTask()
 {
     struct period_info pinfo;
 
-    periodic_task_init(&pinfo);
+    periodic_task_init(&pinfo, cyclePeriodNs);
+    pageFaults.start();
+    cycleMonitor.start(&cycleStatsPtr->master);
 
     while (!exitFlag && systemStateDataPtr->safety_controller_enabled)
     {
-        ecrt_master_application_time(master, ((uint64_t)pinfo.next_period.tv_sec * 1000000000 + pinfo.next_period.tv_nsec));
+        dcAppTimeNs = (uint64_t)pinfo.next_period.tv_sec * 1000000000 + pinfo.next_period.tv_nsec + dcAppTimeOffsetNs;
+        ecrt_master_application_time(master, dcAppTimeNs);
+        if (processImagePtr != nullptr && processImagePtr->external)
+        {
+            processImagePtr->lock.writeBegin();
+        }
         ecrt_master_receive(master);
         ecrt_domain_process(domain);
+#ifdef ECAT_SIMULATION
+        cycleTimestampNs = lockstep ? systemStateDataPtr->virtual_time_ns : monotonic_ns();
+#else
+        cycleTimestampNs = monotonic_ns();
+#endif
+        if (processImagePtr != nullptr)
+        {
+            publishProcessImage();
+        }
         checkDomainState();
         checkMasterState();
+        decode_drive_status();
         do_rt_task();
+        if (cycleStage)
+        {
+            cycleStage(stageFeedback, stageTargets);
+        }
+        apply_targets();
+        process_sdo_requests();
+        if (--diagnosticsCountdown <= 0)
+        {
+            process_diagnostics();
+            diagnosticsCountdown = diagnosticsCycles;
+        }
+
+        // Feedback for this cycle is in JointData, start the safety controller and planner
+        masterCycleSignaled = systemStateDataPtr->master_cycle.signal();
+
         ecrt_domain_queue(domain);
+        if (measureLatency)
+        {
+            record_latency();
+        }
+        if (distributedClocks)
+        {
+            sync_distributed_clocks(&pinfo);
+        }
         ecrt_master_send(master);
+        pageFaults.tick(rtLog);
+        cycleMonitor.sleep(pinfo.period_ns);
         wait_rest_of_period(&pinfo);
+#ifdef ECAT_SIMULATION
+        if (lockstep)
+        {
+            cycleMonitor.wakeOnEvent();
+            continue;
+        }
+#endif
+        cycleMonitor.wake(pinfo.next_period);
     }
 
     return;
@@ -57,7 +371,7 @@ void EthercatMaster::cyclicTask()
 
 void EthercatMaster::do_rt_task()
 {
-    switch (systemStateDataPtr->drive_state)
+    switch (systemStateDataPtr->getDriveState())
     {
     case DriveState::INITIALIZE:
         initializeDrives();
@@ -81,7 +395,7 @@ void EthercatMaster::initializeDrives()
     
     int all_drives_enabled = 0;
 
-    for (size_t jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
         EC_WRITE_U16(domainPd + driveOffset[jnt_ctr].max_current, 250);
     }
@@ -89,29 +403,29 @@ void EthercatMaster::initializeDrives()
     if (systemStateDataPtr->initialize_drives == true) // Waiting for command to initialize the Drives
     {
         
-        for (size_t jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+        for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
         {
-            StatusWordValues drive_statusWord = readDriveState(jnt_ctr);
-
-            switch (drive_statusWord)
+            switch (driveStatus[jnt_ctr].state)
             {
-            case StatusWordValues::SW_FAULT_REACTION_ACTIVE:
-                systemStateDataPtr->drive_state = DriveState::ERROR;
+            case Cia402State::FAULT_REACTION_ACTIVE:
+                systemStateDataPtr->setDriveState(DriveState::INITIALIZE, DriveState::ERROR);
                 return;
                 break;
-            case StatusWordValues::SW_FAULT:
-                systemStateDataPtr->drive_state = DriveState::ERROR;
+            case Cia402State::FAULT:
+                systemStateDataPtr->setDriveState(DriveState::INITIALIZE, DriveState::ERROR);
                 return;
                 break;
-            case StatusWordValues::SW_SWITCH_ON_DISABLED:
+            case Cia402State::SWITCH_ON_DISABLED:
                 transitionToState(ControlWordValues::CW_SHUTDOWN, jnt_ctr);
                 break;
-            case StatusWordValues::SW_READY_TO_SWITCH_ON:
+            case Cia402State::READY_TO_SWITCH_ON:
                 transitionToState(ControlWordValues::CW_SWITCH_ON, jnt_ctr);
                 break;
-            case StatusWordValues::SW_SWITCHED_ON:
+            case Cia402State::SWITCHED_ON:
                 all_drives_enabled++;
                 break;
+            default:
+                break;
             }
         }
     }
@@ -120,10 +434,10 @@ void EthercatMaster::initializeDrives()
     // std::cout<<"joint max current : "<<1<<" : "<<(EC_READ_U16(domainPd + driveOffset[1].max_current))<<std::endl;
 
 
-    if (all_drives_enabled == NUM_JOINTS && systemStateDataPtr->initialize_drives == true)
+    if (all_drives_enabled == numJoints && systemStateDataPtr->initialize_drives == true)
     {
         // std::cout<<"initialize drives "<<std::endl;
-        systemStateDataPtr->drive_state = DriveState::SWITCHED_ON;
+        systemStateDataPtr->setDriveState(DriveState::INITIALIZE, DriveState::SWITCHED_ON);
     }
 }
 
@@ -133,11 +447,11 @@ void EthercatMaster::handleSwitchedOnState()
 
     // std::cout<<"all drives switched on "<<std::endl;
 
-    for (size_t jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        StatusWordValues drive_state = readDriveState(jnt_ctr);
+        Cia402State drive_state = driveStatus[jnt_ctr].state;
 
-        if (drive_state == StatusWordValues::SW_SWITCHED_ON || drive_state == StatusWordValues::SW_OPERATION_ENABLED)
+        if (drive_state == Cia402State::SWITCHED_ON || drive_state == Cia402State::OPERATION_ENABLED)
         {
             // EC_WRITE_U16(domainPd + driveOffset[jnt_ctr].max_current, 400);
             all_drives_switched_on++;
@@ -145,34 +459,34 @@ void EthercatMaster::handleSwitchedOnState()
     }
 
 
-    if (all_drives_switched_on == NUM_JOINTS)
+    if (all_drives_switched_on == numJoints)
     {
         read_data();
         systemStateDataPtr->start_safety_check = true;
         if (systemStateDataPtr->safety_check_done && systemStateDataPtr->switch_to_operation)
         {
             int all_drives_op_enable = 0;
-            for (size_t jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+            for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
             {
                 transitionToState(ControlWordValues::CW_ENABLE_OPERATION, jnt_ctr);
-                StatusWordValues drive_state = readDriveState(jnt_ctr);
+                Cia402State drive_state = driveStatus[jnt_ctr].state;
 
-                if (drive_state == StatusWordValues::SW_OPERATION_ENABLED)
+                if (drive_state == Cia402State::OPERATION_ENABLED)
                 {
                     // EC_WRITE_U16(domainPd + driveOffset[jnt_ctr].max_current, 1000);
                     all_drives_op_enable++;
                 }
             }
 
-            if (all_drives_op_enable == NUM_JOINTS)
+            if (all_drives_op_enable == numJoints)
             {
-                systemStateDataPtr->drive_state = DriveState::OPERATION_ENABLED;
+                systemStateDataPtr->setDriveState(DriveState::SWITCHED_ON, DriveState::OPERATION_ENABLED);
             }
         }
     }
     else
     {
-        systemStateDataPtr->drive_state = DriveState::ERROR;
+        systemStateDataPtr->setDriveState(DriveState::SWITCHED_ON, DriveState::ERROR);
         return;
     }
 }
@@ -182,20 +496,20 @@ void EthercatMaster::handleOperationEnabledState()
 
     int all_drives_op_enable = 0;
 
-    for (size_t jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        StatusWordValues drive_state = readDriveState(jnt_ctr);
+        Cia402State drive_state = driveStatus[jnt_ctr].state;
 
         // std::cout<<"joint current : "<<jnt_ctr<<" : "<<(EC_READ_S16(domainPd + driveOffset[jnt_ctr].current_actual_value))<<std::endl;
         // jointDataPtr->joint_torque[jnt_ctr] = EC_READ_S16(domainPd + driveOffset[jnt_ctr].torque_actual_value);
 
-        if (drive_state == StatusWordValues::SW_OPERATION_ENABLED)
+        if (drive_state == Cia402State::OPERATION_ENABLED)
         {
             all_drives_op_enable++;
         }
     }
 
-    if (all_drives_op_enable == NUM_JOINTS)
+    if (all_drives_op_enable == numJoints)
     {
         read_data();
 
@@ -203,39 +517,66 @@ void EthercatMaster::handleOperationEnabledState()
 
         jointDataPtr->sterile_detection_status = true;
         jointDataPtr->instrument_detection_status = true;
-
-        switch (systemStateDataPtr->drive_operation_mode)
-        {
-        case OperationModeState::POSITION_MODE:
-            handlePositionMode();
-            break;
-        case OperationModeState::VELOCITY_MODE:
-            handleVelocityMode();
-            break;
-        case OperationModeState::TORQUE_MODE:
-            handleTorqueMode();
-            break;
-        }
+        stageFeedback.sterile_detection_status = true;
+        stageFeedback.instrument_detection_status = true;
+        targetsDue = true;
     }
     else
     {
-        systemStateDataPtr->drive_state = DriveState::ERROR;
+        systemStateDataPtr->setDriveState(DriveState::OPERATION_ENABLED, DriveState::ERROR);
+        return;
+    }
+}
+
+void EthercatMaster::apply_targets()
+{
+    if (!targetsDue)
+    {
         return;
     }
+    targetsDue = false;
+
+    switch (systemStateDataPtr->drive_operation_mode)
+    {
+    case OperationModeState::POSITION_MODE:
+        handlePositionMode();
+        break;
+    case OperationModeState::VELOCITY_MODE:
+        handleVelocityMode();
+        break;
+    case OperationModeState::TORQUE_MODE:
+        handleTorqueMode();
+        break;
+    }
 }
 
 void EthercatMaster::handlePositionMode()
 {
-    for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    double target_position[MAX_JOINTS];
+    double target_torque[MAX_JOINTS];
+
+    int64_t source_timestamp_ns;
+
+    // On a torn snapshot keep last cycle's targets in the process image
+    bool targets_valid = read_targets(target_position, target_torque, source_timestamp_ns);
+    if (targets_valid)
+    {
+        appliedTargetTimestampNs = source_timestamp_ns;
+    }
+
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
         EC_WRITE_U16(domainPd + driveOffset[jnt_ctr].modes_of_operation, 8);
-        EC_WRITE_S32(domainPd + driveOffset[jnt_ctr].target_position, jointDataPtr->target_position[jnt_ctr]);
+        if (targets_valid)
+        {
+            EC_WRITE_S32(domainPd + driveOffset[jnt_ctr].target_position, target_position[jnt_ctr]);
+        }
     }
 }
 
 void EthercatMaster::handleVelocityMode()
 {
-    for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
         EC_WRITE_U16(domainPd + driveOffset[jnt_ctr].modes_of_operation, 9);
     }
@@ -243,10 +584,25 @@ void EthercatMaster::handleVelocityMode()
 
 void EthercatMaster::handleTorqueMode()
 {
-    for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    double target_position[MAX_JOINTS];
+    double target_torque[MAX_JOINTS];
+
+    int64_t source_timestamp_ns;
+
+    // On a torn snapshot keep last cycle's targets in the process image
+    bool targets_valid = read_targets(target_position, target_torque, source_timestamp_ns);
+    if (targets_valid)
+    {
+        appliedTargetTimestampNs = source_timestamp_ns;
+    }
+
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
         EC_WRITE_U16(domainPd + driveOffset[jnt_ctr].modes_of_operation, 10);
-        EC_WRITE_S16(domainPd + driveOffset[jnt_ctr].target_torque, jointDataPtr->target_torque[jnt_ctr]);
+        if (targets_valid)
+        {
+            EC_WRITE_S16(domainPd + driveOffset[jnt_ctr].target_torque, target_torque[jnt_ctr]);
+        }
     }
 }
 
@@ -256,17 +612,25 @@ void EthercatMaster::handleErrorState()
 
     // Reset Mode of Operation for all the Drives, maybe not required as
 
-    std::cout<<"Drive is in error state\n";
+    if (!errorStateReported)
+    {
+        rtLog.error("Drive is in error state");
+        errorStateReported = true;
+    }
 
-    for (size_t jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        StatusWordValues drive_state = readDriveState(jnt_ctr);
+        Cia402State drive_state = driveStatus[jnt_ctr].state;
 
-        if (drive_state == StatusWordValues::SW_FAULT)
+        if (drive_state == Cia402State::FAULT)
         {
-            transitionToState(ControlWordValues::CW_RESET, jnt_ctr);
+            // The reset clears the error code, hold it until the error code is read
+            if (!faultCodePending[jnt_ctr])
+            {
+                transitionToState(ControlWordValues::CW_RESET, jnt_ctr);
+            }
         }
-        else if (drive_state == StatusWordValues::SW_SWITCH_ON_DISABLED)
+        else if (drive_state == Cia402State::SWITCH_ON_DISABLED)
         {
             all_drives_switched_on++;
         }
@@ -276,19 +640,118 @@ void EthercatMaster::handleErrorState()
         }
     }
 
-    if (all_drives_switched_on == NUM_JOINTS)
+    if (all_drives_switched_on == numJoints)
     {
-        systemStateDataPtr->drive_state = DriveState::INITIALIZE;
+        systemStateDataPtr->setDriveState(DriveState::ERROR, DriveState::INITIALIZE);
+        errorStateReported = false;
     }
 }
 
+void EthercatMaster::publishProcessImage()
+{
+    if (!processImagePtr->external)
+    {
+        // One bulk copy instead of a conversion per joint and PDO
+        processImagePtr->lock.writeBegin();
+        memcpy(processImagePtr->data, domainPd, processImagePtr->size);
+    }
+
+    processImagePtr->timestamp_ns = cycleTimestampNs;
+    processImagePtr->lock.writeEnd();
+}
+
 void EthercatMaster::read_data()
 {
+    if (cycleStage)
+    {
+        // Handed to the stage by reference, it runs in this thread before anyone else could look
+        stageFeedback.feedback_timestamp_ns = cycleTimestampNs;
+        for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
+        {
+            stageFeedback.joint_position[jnt_ctr] = EC_READ_S32(domainPd + driveOffset[jnt_ctr].position_actual_value);
+            stageFeedback.joint_velocity[jnt_ctr] = EC_READ_S32(domainPd + driveOffset[jnt_ctr].velocity_actual_value);
+            stageFeedback.joint_torque[jnt_ctr] = EC_READ_S16(domainPd + driveOffset[jnt_ctr].torque_actual_value);
+        }
+        return;
+    }
 
-    for (int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    if (processImagePtr != nullptr)
+    {
+        // Consumers decode the exported process image themselves
+        return;
+    }
+
+    jointDataPtr->feedback_lock.writeBegin();
+
+    jointDataPtr->feedback_timestamp_ns = cycleTimestampNs;
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
         jointDataPtr->joint_position[jnt_ctr] = EC_READ_S32(domainPd + driveOffset[jnt_ctr].position_actual_value);
         jointDataPtr->joint_velocity[jnt_ctr] = EC_READ_S32(domainPd + driveOffset[jnt_ctr].velocity_actual_value);
         jointDataPtr->joint_torque[jnt_ctr] = EC_READ_S16(domainPd + driveOffset[jnt_ctr].torque_actual_value);
     }
+
+    jointDataPtr->feedback_lock.writeEnd();
+}
+
+bool EthercatMaster::read_targets(double target_position[MAX_JOINTS], double target_torque[MAX_JOINTS], int64_t &source_timestamp_ns)
+{
+    if (cycleStage)
+    {
+        // The stage wrote them earlier in this cycle
+        std::copy_n(stageTargets.target_position, numJoints, target_position);
+        std::copy_n(stageTargets.target_torque, numJoints, target_torque);
+        source_timestamp_ns = stageTargets.target_source_timestamp_ns;
+        return true;
+    }
+
+    // Bounded retries only, the master must never wait on the safety controller
+    for (int attempt = 0; attempt < SEQLOCK_MAX_RETRIES; attempt++)
+    {
+        uint32_t seq = jointDataPtr->command_lock.readBegin();
+
+        std::copy_n(jointDataPtr->target_position, numJoints, target_position);
+        std::copy_n(jointDataPtr->target_torque, numJoints, target_torque);
+        source_timestamp_ns = jointDataPtr->target_source_timestamp_ns;
+
+        if (jointDataPtr->command_lock.readValid(seq))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EthercatMaster::record_latency()
+{
+    if (appliedTargetTimestampNs == 0)
+    {
+        return;
+    }
+
+    if (appliedTargetTimestampNs == measuredTargetTimestampNs)
+    {
+        latencyStats.stale_cycles++;
+        return;
+    }
+
+    latencyStats.add(monotonic_ns() - appliedTargetTimestampNs);
+    measuredTargetTimestampNs = appliedTargetTimestampNs;
+}
+
+void EthercatMaster::print_latency()
+{
+    if (latencyStats.samples == 0)
+    {
+        printf("Sensor to setpoint latency: no samples\n");
+        return;
+    }
+
+    printf("Sensor to setpoint latency over %lu setpoints: min %.1f us, avg %.1f us, max %.1f us, last %.1f us, stale cycles %lu\n",
+           (unsigned long)latencyStats.samples,
+           latencyStats.min_ns / 1000.0,
+           latencyStats.sum_ns / 1000.0 / latencyStats.samples,
+           latencyStats.max_ns / 1000.0,
+           latencyStats.last_ns / 1000.0,
+           (unsigned long)latencyStats.stale_cycles);
 }
\ No newline at end of file
@@ -1,20 +1,114 @@
 #include "cyclicTask.h"
 using namespace std;
 
+#ifndef INSTRUMENT_RT
 int main(int argc, char **argv)
 {
-    // Create an instance of the Master class
-    EthercatMaster ecat_master;
+    int num_masters = 1;
+    bool measure_latency = false;
+    bool export_process_image = false;
+    bool distributed_clocks = false;
+#ifdef ECAT_SIMULATION
+    bool free_run = false;
+#endif
+    OverrunPolicy overrun_policy = OverrunPolicy::SKIP;
+
+    for (int arg_ctr = 1; arg_ctr < argc; arg_ctr++)
+    {
+        if (strcmp(argv[arg_ctr], "--measure-latency") == 0)
+        {
+            measure_latency = true;
+        }
+        else if (strcmp(argv[arg_ctr], "--export-process-image") == 0)
+        {
+            export_process_image = true;
+        }
+        else if (strcmp(argv[arg_ctr], "--dc") == 0)
+        {
+            distributed_clocks = true;
+        }
+        else if (strcmp(argv[arg_ctr], "--overrun-policy") == 0 && arg_ctr + 1 < argc)
+        {
+            if (!parseOverrunPolicy(argv[++arg_ctr], overrun_policy))
+            {
+                fprintf(stderr, "Unknown overrun policy %s, use skip, reanchor or catch-up.\n", argv[arg_ctr]);
+                return 1;
+            }
+        }
+#ifdef ECAT_SIMULATION
+        else if (strcmp(argv[arg_ctr], "--free-run") == 0)
+        {
+            free_run = true;
+        }
+#endif
+        else if (strcmp(argv[arg_ctr], "--masters") == 0 && arg_ctr + 1 < argc)
+        {
+            num_masters = strtol(argv[++arg_ctr], NULL, 10);
+            if (num_masters < 1 || num_masters > MAX_MASTERS)
+            {
+                fprintf(stderr, "Unsupported number of masters %s, use 1 to %d.\n", argv[arg_ctr], MAX_MASTERS);
+                return 1;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<EthercatMaster>> masters;
+    for (int line = 0; line < num_masters; line++)
+    {
+        masters.push_back(std::make_unique<EthercatMaster>(line));
+        EthercatMaster &ecat_master = *masters.back();
+
+        if (measure_latency)
+        {
+            ecat_master.enableLatencyMeasurement();
+        }
+        if (export_process_image)
+        {
+            ecat_master.enableProcessImageExport();
+        }
+        if (distributed_clocks)
+        {
+            ecat_master.enableDistributedClocks();
+        }
+        if (num_masters > 1)
+        {
+            ecat_master.lockReferenceClocksToTimeBase();
+        }
+        ecat_master.setOverrunPolicy(overrun_policy);
+#ifdef ECAT_SIMULATION
+        if (free_run)
+        {
+            ecat_master.enableFreeRun();
+        }
+#endif
+    }
+
+    if (num_masters == 1)
+    {
+        masters[0]->run();
+        return 0;
+    }
 
-    // Run the main functionality of your program
-    ecat_master.run();
+    // One RT thread per line, each pins itself in run()
+    std::vector<std::thread> lines;
+    for (std::unique_ptr<EthercatMaster> &ecat_master : masters)
+    {
+        lines.emplace_back(&EthercatMaster::run, ecat_master.get());
+    }
+    for (std::thread &thread : lines)
+    {
+        thread.join();
+    }
 
     return 0; // Indicate successful program execution
 }
+#endif
 
-EthercatMaster::EthercatMaster()
+EthercatMaster::EthercatMaster(int line) : line(line)
 {
-    master = ecrt_request_master(0);
+    snprintf(logName, sizeof(logName), line == 0 ? "ecat_master" : "ecat_master.%d", line);
+
+    master = ecrt_request_master(line);
     if (!master)
     {
         throw std::runtime_error("Failed to retrieve Master.");
@@ -39,41 +133,39 @@ EthercatMaster::EthercatMaster()
         throw std::runtime_error("Failed to create process data domain.");
     }
 
-    for (uint16_t jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    scanBus();
+
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
         ec_slave_config_t *sc;
+        const JointSlave &slave = jointSlave[jnt_ctr];
 
         std::cout<<"configuring joint jnt_ctr : "<<jnt_ctr<<std::endl;
-        uint16_t index_ctr = jnt_ctr + 1;
 
-        if (!(sc = ecrt_master_slave_config(master, 0, index_ctr, ingeniaDenalliXcr)))
+        if (!(sc = ecrt_master_slave_config(master, 0, slave.position, slave.type->vendor_id, slave.type->product_code)))
         {
             fprintf(stderr, "Failed to get slave configuration.\n");
             return;
         }
+        slaveConfig[jnt_ctr] = sc;
 
         std::cout<<"Assigning PDOs for jnt_ctr : "<<jnt_ctr<<std::endl;
         pdoMapping(sc);
 
         ec_pdo_entry_reg_t domain_regs[] = {
 
-            {0, index_ctr, ingeniaDenalliXcr, 0x6041, 0, &driveOffset[jnt_ctr].statusword},                // 6041 0 statusword
-            {0, index_ctr, ingeniaDenalliXcr, 0x6061, 0, &driveOffset[jnt_ctr].mode_of_operation_display}, // 6061 0 mode_of_operation_display
-            {0, index_ctr, ingeniaDenalliXcr, 0x6064, 0, &driveOffset[jnt_ctr].position_actual_value},     // 6064 0 pos_act_val
-            {0, index_ctr, ingeniaDenalliXcr, 0x606C, 0, &driveOffset[jnt_ctr].velocity_actual_value},     // 606C 0 vel_act_val
-            {0, index_ctr, ingeniaDenalliXcr, 0x6077, 0, &driveOffset[jnt_ctr].torque_actual_value},       // 6077 0 torq_act_val check this
-            {0, index_ctr, ingeniaDenalliXcr, 0x603F, 0, &driveOffset[jnt_ctr].error_code},                // 603F 0 digital_input_value
-            {0, index_ctr, ingeniaDenalliXcr, 0x6040, 0, &driveOffset[jnt_ctr].controlword},               // 6040 0 control word
-            {0, index_ctr, ingeniaDenalliXcr, 0x6060, 0, &driveOffset[jnt_ctr].modes_of_operation},        // 6060 0 mode_of_operation
-            {0, index_ctr, ingeniaDenalliXcr, 0x6071, 0, &driveOffset[jnt_ctr].target_torque},             // 6071 0 target torque
-            {0, index_ctr, ingeniaDenalliXcr, 0x607A, 0, &driveOffset[jnt_ctr].target_position},           // 607A 0 target position
-            {0, index_ctr, ingeniaDenalliXcr, 0x6073, 0, &driveOffset[jnt_ctr].max_current},               // 6073 0 max current
-            {0, index_ctr, ingeniaDenalliXcr, 0x6078, 0, &driveOffset[jnt_ctr].current_actual_value},      // 6078 0 current actual value
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x6041, 0, &driveOffset[jnt_ctr].statusword},                // 6041 0 statusword
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x6064, 0, &driveOffset[jnt_ctr].position_actual_value},     // 6064 0 pos_act_val
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x606C, 0, &driveOffset[jnt_ctr].velocity_actual_value},     // 606C 0 vel_act_val
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x6077, 0, &driveOffset[jnt_ctr].torque_actual_value},       // 6077 0 torq_act_val check this
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x6040, 0, &driveOffset[jnt_ctr].controlword},               // 6040 0 control word
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x6060, 0, &driveOffset[jnt_ctr].modes_of_operation},        // 6060 0 mode_of_operation
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x6071, 0, &driveOffset[jnt_ctr].target_torque},             // 6071 0 target torque
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x607A, 0, &driveOffset[jnt_ctr].target_position},           // 607A 0 target position
+            {0, slave.position, slave.type->vendor_id, slave.type->product_code, 0x6073, 0, &driveOffset[jnt_ctr].max_current},               // 6073 0 max current
 
             {}};
 
-        // ecrt_slave_config_dc(sc, 0x0300, 1000000, 0, 0, 0);
-
         /** Registers a bunch of PDO entries for a domain.
          *
          * This method has to be called in non-realtime context before
@@ -93,13 +185,63 @@ EthercatMaster::EthercatMaster()
         }
 
         ecrt_slave_config_sdo16(sc, 0x6073, 0, 400);
+    }
 
-        std::cout<<ecrt_domain_size(domain)<<std::endl;
+    configureSharedMemory();
+    systemStateDataPtr->num_joints.store(numJoints, std::memory_order_release);
+}
 
-        // ecrt_slave_config_dc for assignActivate/sync0,1 cycle and shift values for each drive/slave....
+void EthercatMaster::scanBus()
+{
+    // The master may still be scanning the bus right after it was requested
+    ec_master_info_t master_info;
+    if (ecrt_master(master, &master_info))
+    {
+        throw std::runtime_error("Failed to read the master information.");
+    }
+    while (master_info.scan_busy && !exitFlag)
+    {
+        usleep(BUS_SCAN_POLL_US);
+        ecrt_master(master, &master_info);
     }
 
-    configureSharedMemory();
+    for (uint16_t position = 0; position < master_info.slave_count; position++)
+    {
+        ec_slave_info_t slave_info;
+        if (ecrt_master_get_slave(master, position, &slave_info))
+        {
+            throw std::runtime_error("Failed to read the slave information.");
+        }
+
+        const DriveType *type = nullptr;
+        for (const DriveType &drive : SUPPORTED_DRIVES)
+        {
+            if (drive.vendor_id == slave_info.vendor_id && drive.product_code == slave_info.product_code)
+            {
+                type = &drive;
+                break;
+            }
+        }
+
+        if (type == nullptr)
+        {
+            printf("Slave %u: %s (0x%08X:0x%08X) is not a drive, skipped\n", position, slave_info.name,
+                   slave_info.vendor_id, slave_info.product_code);
+            continue;
+        }
+        if (numJoints == MAX_JOINTS)
+        {
+            throw std::runtime_error("More drives on the bus than MAX_JOINTS.");
+        }
+
+        printf("Slave %u: %s, joint %d\n", position, type->name, numJoints);
+        jointSlave[numJoints++] = {position, type};
+    }
+
+    if (numJoints == 0)
+    {
+        throw std::runtime_error("No supported drive found on the bus.");
+    }
 }
 
 EthercatMaster::~EthercatMaster()
@@ -113,18 +255,50 @@ EthercatMaster::~EthercatMaster()
     }
 
     // Release shared memory
-    if (jointDataPtr != nullptr)
-    {
-        munmap(jointDataPtr, sizeof(JointData));
-    }
-    if (systemStateDataPtr != nullptr)
+    unmapSegment(jointDataPtr);
+    unmapSegment(systemStateDataPtr);
+    unmapSegment(cycleStatsPtr);
+    unmapSegment(sdoQueuePtr);
+    if (processImagePtr != nullptr)
     {
-        munmap(systemStateDataPtr, sizeof(SystemStateData));
+        processImagePtr->size = 0; // tell consumers to fall back to JointData
+        unmapSegment(processImagePtr);
     }
 }
 
 void EthercatMaster::run()
 {
+    // Started before the affinity and priority changes below so it stays a normal thread
+    rtLog.start(logName);
+
+    if (exportProcessImage)
+    {
+        configureProcessImage();
+    }
+
+    // Register signal handler to gracefully stop the program
+    signal(SIGINT, EthercatMaster::signalHandler);
+
+    // The safety controller owns the cycle period, it has to be known before activation
+    printf("Waiting for Safety Controller to get Started ...\n");
+    // Wakes as soon as the safety controller is up, the timeout only lets SIGINT through
+    struct timespec exit_poll = {0, 100000000};
+    while (!systemStateDataPtr->safety_ready.wait(&exit_poll) && !exitFlag)
+    {
+    }
+
+    if (isSupportedCyclePeriod(systemStateDataPtr->cycle_period_ns))
+    {
+        cyclePeriodNs = systemStateDataPtr->cycle_period_ns;
+    }
+    printf("Safety Controller Started, cycle period %ld us\n", cyclePeriodNs / 1000);
+
+    if (distributedClocks)
+    {
+        configureDistributedClocks();
+    }
+
+    configureSdoRequests();
 
     // Activate the master
     printf("Activating master...\n");
@@ -153,10 +327,22 @@ void EthercatMaster::run()
         return;
     }
 
+    diagnosticsCycles = std::max(1L, DIAGNOSTICS_PERIOD_NS / cyclePeriodNs);
+    printf("Process data: %zu bytes every cycle, drive diagnostics read every %ld cycles\n",
+           ecrt_domain_size(domain), diagnosticsCycles);
+
+    if (processImagePtr != nullptr)
+    {
+        // The userspace library may ignore external memory, then we copy the image once per cycle
+        processImagePtr->external = (domainPd == processImagePtr->data);
+        printf("Exporting process image (%u bytes, %s)\n", processImagePtr->size,
+               processImagePtr->external ? "zero-copy" : "copied once per cycle");
+    }
+
     // Set CPU affinity for real-time thread
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);
-    CPU_SET(3, &cpuset); // Set to the desired CPU core
+    CPU_SET(MASTER_CPU + line, &cpuset); // Set to the desired CPU core
 
     if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == -1)
     {
@@ -173,9 +359,6 @@ void EthercatMaster::run()
 
     stackPrefault();
 
-    // Register signal handler to gracefully stop the program
-    signal(SIGINT, EthercatMaster::signalHandler);
-
     struct sched_param param = {};
     param.sched_priority = 49;
 
@@ -185,23 +368,19 @@ void EthercatMaster::run()
     }
 
     // Set real-time interval for the master
-    ecrt_master_set_send_interval(master, 1000);
+    ecrt_master_set_send_interval(master, cyclePeriodNs / 1000);
 
     // ecrt_slave_config_state(sc, EC_STATE_SAFE_OP);
 
-    printf("Waiting for Safety Controller to get Started ...\n");
-    while (!systemStateDataPtr->safety_controller_enabled && !exitFlag)
-    {
-        // Make a semaphore lock to open, Easy way out is sleep
-        sleep(1);
-    }
-
-
-    
-
-    printf("Safety Controller Started \n");
+    latencyStats.reset();
 
     cyclicTask();
+    rtLog.stop();
+
+    if (measureLatency)
+    {
+        print_latency();
+    }
 
     
 }
@@ -357,14 +536,12 @@ void EthercatMaster::pdoMapping(ec_slave_config_t *sc)
     ecrt_slave_config_pdo_mapping_clear(sc, 0x1A02);
 
     ecrt_slave_config_pdo_mapping_add(sc, 0x1A00, 0x6041, 0, 16); /* 0x6041:0/16bits, Statusword */
-    ecrt_slave_config_pdo_mapping_add(sc, 0x1A00, 0x6061, 0, 8);  /* 0x6061:0/8bits, Modes of operation display */
     ecrt_slave_config_pdo_mapping_add(sc, 0x1A00, 0x6064, 0, 32); /* 0x6064:0/32bits, Position Actual Value */
     ecrt_slave_config_pdo_mapping_add(sc, 0x1A00, 0x606C, 0, 32); /* 0x606C:0/32bits, velocity_actual_value */
     ecrt_slave_config_pdo_mapping_add(sc, 0x1A00, 0x6077, 0, 16); /* 0x6077:0/16bits, Torque Actual Value */
-    ecrt_slave_config_pdo_mapping_add(sc, 0x1A00, 0x6078, 0, 16); /* 0x6077:0/16bits, Torque Actual Value */
 
     // ecrt_slave_config_pdo_mapping_add(sc, 0x1A01, 0x2600, 0, 32); /* 0x60FD:0/32bits, Digital Inputs */
-    ecrt_slave_config_pdo_mapping_add(sc, 0x1A01, 0x603F, 0, 16); /* 0x603F:0/16bits, Error Code */
+    // 0x6061 mode display, 0x6078 current and 0x603F error code are read over SDO, see process_diagnostics()
 
 }
 
@@ -381,57 +558,113 @@ void EthercatMaster::signalHandler(int signum)
 
 void EthercatMaster::configureSharedMemory()
 {
-    int shm_fd_jointData;
-    int shm_fd_systemStateData;
-
-    createSharedMemory(shm_fd_jointData, "JointData", sizeof(JointData));
-    createSharedMemory(shm_fd_systemStateData, "SystemStateData", sizeof(SystemStateData));
-
-    mapSharedMemory((void *&)jointDataPtr, shm_fd_jointData, sizeof(JointData));
-    mapSharedMemory((void *&)systemStateDataPtr, shm_fd_systemStateData, sizeof(SystemStateData));
+    jointDataPtr = mapSegment<JointData>("JointData", line);
+    systemStateDataPtr = mapSegment<SystemStateData>("SystemStateData", line);
+    cycleStatsPtr = mapSegment<CycleStats>("CycleStats", line);
+    sdoQueuePtr = mapSegment<SdoQueue>("SdoQueue", line);
 
     initializeSharedData();
 }
 
-void EthercatMaster::createSharedMemory(int &shm_fd, const char *name, int size)
+void EthercatMaster::initializeSharedData()
 {
-    shm_fd = shm_open(name, O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1)
+    jointDataPtr->setZero();
+    systemStateDataPtr->setZero();
+    sdoQueuePtr->setZero();
+}
+
+void EthercatMaster::configureSdoRequests()
+{
+    // Has to be done before ecrt_master_activate(), the index is set per transfer
+    const size_t sizes[3] = {1, 2, 4};
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        throw std::runtime_error("Failed to create shared memory object.");
+        sdoActiveSlot[jnt_ctr] = -1;
+        if (slaveConfig[jnt_ctr] == nullptr)
+        {
+            continue;
+        }
+
+        for (int size_ctr = 0; size_ctr < 3; size_ctr++)
+        {
+            ec_sdo_request_t *request = ecrt_slave_config_create_sdo_request(slaveConfig[jnt_ctr], 0x6073, 0, sizes[size_ctr]);
+            if (!request)
+            {
+                throw std::runtime_error("Failed to create SDO request.");
+            }
+            ecrt_sdo_request_timeout(request, SDO_TIMEOUT_MS);
+            sdoRequest[jnt_ctr][size_ctr] = request;
+        }
+
+        for (int object_ctr = 0; object_ctr < NUM_DIAGNOSTIC_OBJECTS; object_ctr++)
+        {
+            const DiagnosticObject &object = DIAGNOSTIC_OBJECTS[object_ctr];
+            ec_sdo_request_t *request = ecrt_slave_config_create_sdo_request(slaveConfig[jnt_ctr], object.index, 0, object.size);
+            if (!request)
+            {
+                throw std::runtime_error("Failed to create SDO request.");
+            }
+            ecrt_sdo_request_timeout(request, SDO_TIMEOUT_MS);
+            diagnosticsRequest[jnt_ctr][object_ctr] = request;
+        }
     }
-    ftruncate(shm_fd, size);
 }
 
-void EthercatMaster::mapSharedMemory(void *&ptr, int shm_fd, int size)
+void EthercatMaster::configureDistributedClocks()
 {
-    ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (ptr == MAP_FAILED)
+    // Has to be done before ecrt_master_activate()
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
+    {
+        if (slaveConfig[jnt_ctr] == nullptr)
+        {
+            throw std::runtime_error("Drive is not configured, cannot enable distributed clocks.");
+        }
+        ecrt_slave_config_dc(slaveConfig[jnt_ctr], DC_ASSIGN_ACTIVATE, cyclePeriodNs, cyclePeriodNs / 2, 0, 0);
+    }
+
+    if (ecrt_master_select_reference_clock(master, slaveConfig[0]))
     {
-        throw std::runtime_error("Failed to map shared memory.");
+        throw std::runtime_error("Failed to select the DC reference clock.");
     }
+
+    printf("Distributed clocks enabled, SYNC0 every %ld us shifted by %ld us\n", cyclePeriodNs / 1000, cyclePeriodNs / 2000);
 }
 
-void EthercatMaster::initializeSharedData()
+void EthercatMaster::configureProcessImage()
 {
-    jointDataPtr->setZero();
-    systemStateDataPtr->setZero();
+    size_t domain_size = ecrt_domain_size(domain);
+    if (domain_size > PROCESS_IMAGE_MAX_SIZE)
+    {
+        throw std::runtime_error("Process image does not fit into the shared memory segment.");
+    }
+
+    processImagePtr = mapSegment<ProcessImage>("ProcessImage", line);
+
+    processImagePtr->setZero();
+    std::copy_n(driveOffset, numJoints, processImagePtr->offsets);
+
+    // Has to be registered before ecrt_master_activate()
+    ecrt_domain_external_memory(domain, processImagePtr->data);
+
+    processImagePtr->size = domain_size;
 }
 
 void EthercatMaster::checkDomainState()
 {
-    // cout << "check_domain_state" << endl;
     ec_domain_state_t ds;
 
-    ecrt_domain_state(domain, &ds); // to do - do for all domains
+    ecrt_domain_state(domain, &ds);
 
-    if (ds.working_counter != domainState.working_counter)
-    {
-        // printf("Domain1: WC %u.\n", ds.working_counter);
-    }
     if (ds.wc_state != domainState.wc_state)
     {
-        // printf("Domain1: State %u.\n", ds.wc_state);
+        if (ds.wc_state == EC_WC_COMPLETE)
+        {
+            rtLog.info("Domain: WC %u, complete.", ds.working_counter);
+        }
+        else
+        {
+            rtLog.warn("Domain: WC %u, %s.", ds.working_counter, ds.wc_state == EC_WC_ZERO ? "zero" : "incomplete");
+        }
     }
 
     domainState = ds;
@@ -446,15 +679,15 @@ void EthercatMaster::checkMasterState()
 
     if (ms.slaves_responding != masterState.slaves_responding)
     {
-        printf("%u slave(s).\n", ms.slaves_responding);
+        rtLog.info("%u slave(s).", ms.slaves_responding);
     }
     if (ms.al_states != masterState.al_states)
     {
-        printf("AL states: 0x%02X.\n", ms.al_states);
+        rtLog.info("AL states: 0x%02X.", ms.al_states);
     }
     if (ms.link_up != masterState.link_up)
     {
-        printf("Link is %s.\n", ms.link_up ? "up" : "down");
+        rtLog.info("Link is %s.", ms.link_up ? "up" : "down");
     }
 
     masterState = ms;
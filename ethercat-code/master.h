@@ -14,24 +14,12 @@
 #include <csignal>
 #include <cstdlib>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
 #include <ecrt.h>
-#include "SharedObject.h"
-
-struct JointPdos
-{
-    unsigned int statusword;
-    unsigned int mode_of_operation_display;
-    unsigned int position_actual_value;
-    unsigned int velocity_actual_value;
-    unsigned int torque_actual_value;
-    unsigned int error_code;
-    unsigned int controlword;
-    unsigned int modes_of_operation;
-    unsigned int target_torque;
-    unsigned int target_position;
-    unsigned int max_current;
-    unsigned int current_actual_value;
-};
+#include "SharedMemory.h"
+#include "ExitFlag.h"
 
 enum class ControlWordValues : uint16_t
 {
@@ -44,52 +32,195 @@ enum class ControlWordValues : uint16_t
     // Add more control word values as needed
 };
 
-enum class StatusWordValues : uint16_t
+// Sensor-to-setpoint latency: time from ecrt_domain_process() of the sample a
+// target was planned from until that target is queued to the drives.
+struct LatencyStats
+{
+    void reset()
+    {
+        last_ns = 0;
+        min_ns = INT64_MAX;
+        max_ns = 0;
+        sum_ns = 0;
+        samples = 0;
+        stale_cycles = 0;
+    }
+
+    void add(int64_t latency_ns)
+    {
+        last_ns = latency_ns;
+        min_ns = std::min(min_ns, latency_ns);
+        max_ns = std::max(max_ns, latency_ns);
+        sum_ns += latency_ns;
+        samples++;
+    }
+
+    int64_t last_ns;
+    int64_t min_ns;
+    int64_t max_ns;
+    int64_t sum_ns;
+    uint64_t samples;
+    uint64_t stale_cycles; // cycles that re-sent a target already measured
+};
+
+// Distributed clocks (--dc): every drive latches its setpoints on SYNC0, the
+// first drive is the reference clock and the master steers its wake-up time
+// with a PI loop so its cycle does not drift against the reference clock.
+// SYNC0 runs at the cycle period, shifted by half a period so the frame
+// reaches the drives first.
+constexpr uint16_t DC_ASSIGN_ACTIVATE = 0x0300; // SYNC0 active
+constexpr double DC_KP = 0.1;
+constexpr double DC_KI = 0.005;
+constexpr long DC_MAX_CORRECTION_DIVISOR = 1000; // per cycle correction limit, 0.1 % of the period
+
+// The cyclic PDOs only carry what the control loop needs. The drive
+// diagnostics (mode display, error code, current) are read over SDO through
+// the mailbox every DIAGNOSTICS_PERIOD_NS instead, so they cost no frame space.
+constexpr long DIAGNOSTICS_PERIOD_NS = 10000000;
+
+struct DiagnosticObject
+{
+    uint16_t index;
+    size_t size;
+};
+
+constexpr DiagnosticObject DIAGNOSTIC_OBJECTS[] = {
+    {0x6061, 1}, // mode of operation display
+    {0x603F, 2}, // error code
+    {0x6078, 2}, // current actual value
+};
+constexpr int NUM_DIAGNOSTIC_OBJECTS = sizeof(DIAGNOSTIC_OBJECTS) / sizeof(DIAGNOSTIC_OBJECTS[0]);
+
+// Latest values read by process_diagnostics()
+struct DriveDiagnostics
 {
-    SW_NOT_READY_TO_SWITCH_ON = 0x0000,
-    SW_SWITCH_ON_DISABLED = 0x0040,
-    SW_READY_TO_SWITCH_ON = 0x0021,
-    SW_SWITCHED_ON = 0x0023,
-    SW_OPERATION_ENABLED = 0x0027,
-    SW_QUICK_STOP_ACTIVE = 0x0007,
-    SW_FAULT_REACTION_ACTIVE = 0x000F,
-    SW_FAULT = 0x0008
-    // Add more status word values as needed
+    int8_t mode_of_operation_display;
+    uint16_t error_code;
+    int16_t current_actual_value;
 };
 
+// Drive types the bus scan accepts as joints
+struct DriveType
+{
+    uint32_t vendor_id;
+    uint32_t product_code;
+    const char *name;
+};
+
+// Bus position of a joint, joints are numbered in bus order
+struct JointSlave
+{
+    uint16_t position;
+    const DriveType *type;
+};
+
+constexpr useconds_t BUS_SCAN_POLL_US = 100000;
+
+// One EtherCAT line per master (--masters N). Line N uses master N, its own
+// shared memory segments (segmentName()) and an RT thread on MASTER_CPU + N.
+// Every line releases its cycles on the same CLOCK_MONOTONIC grid, multiples
+// of the cycle period, so all lines cycle in phase.
+constexpr int MAX_MASTERS = 4;
+constexpr int MASTER_CPU = 3;
+
 class EthercatMaster
 {
 public:
-    EthercatMaster();
+    explicit EthercatMaster(int line);
     ~EthercatMaster();
     void run();
+    void enableLatencyMeasurement() { measureLatency = true; }
+    void enableProcessImageExport() { exportProcessImage = true; }
+    void enableDistributedClocks() { distributedClocks = true; }
+    void setOverrunPolicy(OverrunPolicy policy) { cycleMonitor.policy = policy; }
+    void lockReferenceClocksToTimeBase() { dcReferenceFollowsMaster = true; }
+#ifdef ECAT_SIMULATION
+    void enableFreeRun() { freeRun = true; }
+#endif
+    // instrument_rt: runs in the master's thread between decoding the feedback and
+    // applying the targets, so targets go out in the frame of the cycle they were computed in.
+    // The stage gets this cycle's feedback and fills in the targets, JointData is left alone.
+    void setCycleStage(std::function<void(const JointFeedback &, JointTargets &)> stage) { cycleStage = std::move(stage); }
 
 private:
+    int line;
+    char logName[32];
     ec_master_t *master;
     ec_master_state_t masterState;
+    int numJoints = 0; // drives found by scanBus(), the bound of every per-joint loop
+    JointSlave jointSlave[MAX_JOINTS] = {};
     ec_domain_t *domain;
-    ec_domain_state_t domainState;
-    static uint8_t *domainPd;
-    JointPdos driveOffset[NUM_JOINTS];
+    ec_domain_state_t domainState = {};
+    uint8_t *domainPd = nullptr;
+    long diagnosticsCycles = 1; // cycles between two diagnostics reads
+    long diagnosticsCountdown = 0;
+    DriveDiagnostics diagnostics[MAX_JOINTS] = {};
+    bool faultCodePending[MAX_JOINTS] = {};   // error code is reported with the next diagnostics read
+    bool faultCodeRequested[MAX_JOINTS] = {}; // the running error code read was started after the fault
+    bool errorStateReported = false; // handleErrorState() logs once per visit to ERROR
+    JointPdos driveOffset[MAX_JOINTS];
+    DriveStatus driveStatus[MAX_JOINTS] = {}; // decoded once per cycle by decode_drive_status()
+    ec_slave_config_t *slaveConfig[MAX_JOINTS] = {};
     JointData *jointDataPtr;
     SystemStateData *systemStateDataPtr;
+    ProcessImage *processImagePtr = nullptr;
+    CycleStats *cycleStatsPtr;
+    bool exportProcessImage = false;
+
+    bool measureLatency = false;
+    int64_t cycleTimestampNs = 0;           // taken right after ecrt_domain_process()
+    int64_t appliedTargetTimestampNs = 0;   // sample the targets queued this cycle came from
+    int64_t measuredTargetTimestampNs = 0;
+    LatencyStats latencyStats;
+    PageFaultMonitor pageFaults;
+    RtLogger rtLog;
+    CycleMonitor cycleMonitor;
+    long cyclePeriodNs = DEFAULT_CYCLE_PERIOD_NS; // taken from the safety controller at start-up
+
+    bool distributedClocks = false;
+    bool dcStarted = false;           // reference clock has been aligned to the application time
+    uint64_t dcAppTimeNs = 0;         // application time handed to the master this cycle
+    uint64_t dcPrevAppTimeNs = 0;
+    int64_t dcAppTimeOffsetNs = 0;    // application time minus CLOCK_MONOTONIC wake-up time
+    double dcIntegralNs = 0;
+    bool dcReferenceFollowsMaster = false; // several lines: the reference clocks follow the common grid
+#ifdef ECAT_SIMULATION
+    bool freeRun = false; // simulated drives only: start the next cycle right away
+    bool lockstep = false; // cycles are released by lockstep_driver, see wait_lockstep()
+    uint32_t lockstepTickSeen = 0;
+#endif
+    uint32_t masterCycleSignaled = 0;
+    std::function<void(const JointFeedback &, JointTargets &)> cycleStage;
+    JointFeedback stageFeedback = {}; // what read_data() and decode_drive_status() hand the stage
+    JointTargets stageTargets = {};   // what the stage handed back, read_targets() takes them from here
+    bool targetsDue = false; // drives are in operation, apply_targets() writes this cycle's targets
+
+    // Runtime SDO access (SdoQueue): one request handle per joint and transfer
+    // size, since the data size of a handle is fixed when it is created
+    SdoQueue *sdoQueuePtr;
+    ec_sdo_request_t *sdoRequest[MAX_JOINTS][3] = {};
+    int sdoActiveSlot[MAX_JOINTS];
+    ec_sdo_request_t *diagnosticsRequest[MAX_JOINTS][NUM_DIAGNOSTIC_OBJECTS] = {};
 
     void checkDomainState();
     void checkMasterState();
 
+    void scanBus();
     void pdoMapping(ec_slave_config_t *sc);
 
     void configureSharedMemory();
-    void createSharedMemory(int &shm_fd, const char *name, int size);
-    void mapSharedMemory(void *&ptr, int shm_fd, int size);
     void initializeSharedData();
+    void configureProcessImage();
+    void configureDistributedClocks();
+    void configureSdoRequests();
+    void publishProcessImage();
 
     void stackPrefault();
 
     static void signalHandler(int signum);
 
     // Functions in transistionState.h
-    StatusWordValues readDriveState(int joint_num);
+    void decode_drive_status();
     void transitionToState(ControlWordValues value, int jnt_ctr);
 
     // Functions in cyclicTask.h
@@ -100,32 +231,37 @@ private:
     };
 
     static void inc_period(struct period_info *pinfo);
-    static void periodic_task_init(struct period_info *pinfo);
-    static void wait_rest_of_period(struct period_info *pinfo);
+    static void periodic_task_init(struct period_info *pinfo, long period_ns); // first release on the common grid
+    void wait_rest_of_period(struct period_info *pinfo);
+#ifdef ECAT_SIMULATION
+    void wait_lockstep(struct period_info *pinfo);
+#endif
+    void sync_distributed_clocks(struct period_info *pinfo);
+    void process_diagnostics();
+    void process_sdo_requests();
     void cyclicTask();
     void do_rt_task();
     void initializeDrives();
     void handleSwitchedOnState();
     void handleOperationEnabledState();
+    void apply_targets();
     void handlePositionMode();
     void handleVelocityMode();
     void handleTorqueMode();
     void handleErrorState();
     void read_data();
+    bool read_targets(double target_position[MAX_JOINTS], double target_torque[MAX_JOINTS], int64_t &source_timestamp_ns);
+    void record_latency();
+    void print_latency();
 };
 
-uint8_t *EthercatMaster::domainPd = NULL;
-
-// Define your EtherCAT constants here
-#define DOMAIN1_START 1
-#define DOMAIN1_END (DOMAIN1_START + NUM_JOINTS)
-
-// Example definition, replace it with your actual slave configuration
 #define ingeniaDenalliXcr 0x0000029c, 0x03831002
 
+// Every slave matching one of these becomes the next joint, others are skipped
+constexpr DriveType SUPPORTED_DRIVES[] = {
+    {ingeniaDenalliXcr, "Ingenia Denali XCR"},
+};
+
 #define MAX_SAFE_STACK (8 * 1024) /* The maximum stack size which is  \
                                      guranteed safe to access without \
                                      faulting */
-
-volatile sig_atomic_t exitFlag = 0;
-
@@ -0,0 +1,1106 @@
+// Simulated EtherCAT bus behind the ecrt API (ecat_master_sim). Every
+// requested master owns its own bus: an EK1100 coupler at position 0 and
+// ECRT_SIM_DRIVES (default 4) Denali XCR drives behind it. Each drive runs the
+// CiA402 state machine and a geared motor model, the object dictionary holds
+// the PDO objects and the parameters the model uses.
+//
+// Time is counted in frames, not read from a clock: every ecrt_master_send()
+// latches the inputs, applies the outputs and advances the drives by one send
+// interval. The model gives the same result however fast the master cycles.
+//
+// Process data is laid out like the IgH master does it: registering an entry
+// maps the whole sync manager of that slave into the domain, entries sit at
+// their offset inside the sync manager.
+//
+// ECRT_SIM_DRIVES=<n>                 drives on every bus
+// ECRT_SIM_FAULT=<position>:<frame>   the drive at <position> faults at <frame>
+// ECRT_SIM_STOPS=<position>:<min>:<max>[,...]
+//                                     hard stops of the drive at <position>, output side rad
+
+#include <ecrt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+constexpr uint32_t SIM_COUPLER_VENDOR_ID = 0x00000002;
+constexpr uint32_t SIM_COUPLER_PRODUCT_CODE = 0x044c2c52;
+constexpr uint32_t SIM_DRIVE_VENDOR_ID = 0x0000029c;
+constexpr uint32_t SIM_DRIVE_PRODUCT_CODE = 0x03831002;
+constexpr int SIM_DEFAULT_DRIVES = 4;
+constexpr int SIM_MAX_DRIVES = 64;
+constexpr int SIM_SYNC_MANAGERS = 4;
+constexpr int SIM_SDO_FRAMES = 3; // mailbox round trip of an SDO transfer
+
+// Motor, gear and drive, matching the safety controller's parameters
+constexpr double SIM_MOTOR_INERTIA = 1e-6;  // kg m^2
+constexpr double SIM_LOAD_INERTIA = 1e-3;   // kg m^2, output side
+constexpr double SIM_GEAR_RATIO = 50;
+constexpr double SIM_VISCOUS_FRICTION = 1e-6; // Nm per rad/s, motor side
+constexpr double SIM_RATED_TORQUE = 0.02;     // Nm, 1000 per mille in 0x6071 / 0x6077
+constexpr double SIM_ENCODER_COUNTS = 4096;   // counts per motor revolution
+constexpr double SIM_POSITION_BANDWIDTH = 2 * M_PI * 50; // rad/s
+constexpr double SIM_VELOCITY_BANDWIDTH = 2 * M_PI * 200;
+constexpr int SIM_SUBSTEPS = 10;              // integration steps per frame
+constexpr uint16_t SIM_FOLLOWING_ERROR_CODE = 0x8611;
+constexpr uint16_t SIM_INJECTED_FAULT_CODE = 0x2310; // continuous over current
+
+enum class SimState
+{
+    NOT_READY,
+    SWITCH_ON_DISABLED,
+    READY_TO_SWITCH_ON,
+    SWITCHED_ON,
+    OPERATION_ENABLED,
+    QUICK_STOP_ACTIVE,
+    FAULT_REACTION_ACTIVE,
+    FAULT,
+};
+
+static uint32_t objectKey(uint16_t index, uint8_t subindex)
+{
+    return (uint32_t)index << 8 | subindex;
+}
+
+struct SimPdoEntry
+{
+    uint16_t index;
+    uint8_t subindex;
+    uint8_t bits;
+};
+
+struct SimSlave
+{
+    uint16_t position;
+    uint32_t vendor_id;
+    uint32_t product_code;
+    std::string name;
+    bool drive;
+
+    std::map<uint32_t, uint32_t> objects; // object dictionary, raw values
+    SimState state = SimState::NOT_READY;
+    uint16_t lastControlword = 0;
+    double motorPosition = 0; // rad
+    double motorVelocity = 0; // rad/s
+    double motorTorque = 0;   // Nm
+    bool torqueLimited = false;
+    double lastTargetPosition = 0;
+    bool hasStops = false;
+    double stopMin = 0, stopMax = 0; // motor side rad
+
+    uint32_t &object(uint16_t index, uint8_t subindex = 0) { return objects[objectKey(index, subindex)]; }
+    bool hasObject(uint16_t index, uint8_t subindex) const { return objects.count(objectKey(index, subindex)) != 0; }
+
+    void initDictionary();
+    void step(double period_s);
+    void fault(uint16_t error_code);
+
+private:
+    void handleControlword();
+    double commandedTorque(double target_position, double feedforward_velocity);
+    void updateInputs();
+};
+
+void SimSlave::initDictionary()
+{
+    object(0x1018, 1) = vendor_id;
+    object(0x1018, 2) = product_code;
+    if (!drive)
+    {
+        return;
+    }
+
+    object(0x1000) = 0x00020192; // CiA402 servo drive
+    for (uint16_t index : {0x6040, 0x6060, 0x6071, 0x607A, 0x60FF, 0x6041, 0x6061, 0x6064, 0x606C, 0x6077, 0x6078, 0x603F})
+    {
+        object(index) = 0;
+    }
+    object(0x6073) = 1000;   // max current, per mille of rated current
+    object(0x6065) = 40960;  // following error window, counts
+    object(0x6067) = 100;    // position window, counts
+    object(0x6041) = 0x0200; // remote
+}
+
+void SimSlave::fault(uint16_t error_code)
+{
+    if (state == SimState::FAULT || state == SimState::FAULT_REACTION_ACTIVE)
+    {
+        return;
+    }
+    object(0x603F) = error_code;
+    state = SimState::FAULT_REACTION_ACTIVE;
+}
+
+void SimSlave::handleControlword()
+{
+    uint16_t controlword = object(0x6040);
+    bool shutdown = (controlword & 0x87) == 0x06;
+    bool switch_on = (controlword & 0x8F) == 0x07;
+    bool enable_operation = (controlword & 0x8F) == 0x0F;
+    bool disable_voltage = (controlword & 0x82) == 0x00;
+    bool quick_stop = (controlword & 0x86) == 0x02;
+    bool fault_reset = (controlword & 0x80) && !(lastControlword & 0x80);
+    lastControlword = controlword;
+
+    switch (state)
+    {
+    case SimState::NOT_READY:
+        state = SimState::SWITCH_ON_DISABLED;
+        break;
+    case SimState::SWITCH_ON_DISABLED:
+        if (shutdown)
+        {
+            state = SimState::READY_TO_SWITCH_ON;
+        }
+        break;
+    case SimState::READY_TO_SWITCH_ON:
+        if (switch_on || enable_operation)
+        {
+            state = SimState::SWITCHED_ON;
+        }
+        else if (disable_voltage || quick_stop)
+        {
+            state = SimState::SWITCH_ON_DISABLED;
+        }
+        break;
+    case SimState::SWITCHED_ON:
+        if (enable_operation)
+        {
+            // Take over the current position, CSP must not jump to a stale target
+            lastTargetPosition = motorPosition;
+            state = SimState::OPERATION_ENABLED;
+        }
+        else if (shutdown)
+        {
+            state = SimState::READY_TO_SWITCH_ON;
+        }
+        else if (disable_voltage || quick_stop)
+        {
+            state = SimState::SWITCH_ON_DISABLED;
+        }
+        break;
+    case SimState::OPERATION_ENABLED:
+        if (switch_on)
+        {
+            state = SimState::SWITCHED_ON;
+        }
+        else if (shutdown)
+        {
+            state = SimState::READY_TO_SWITCH_ON;
+        }
+        else if (disable_voltage)
+        {
+            state = SimState::SWITCH_ON_DISABLED;
+        }
+        else if (quick_stop)
+        {
+            state = SimState::QUICK_STOP_ACTIVE;
+        }
+        break;
+    case SimState::QUICK_STOP_ACTIVE:
+        if (disable_voltage)
+        {
+            state = SimState::SWITCH_ON_DISABLED;
+        }
+        break;
+    case SimState::FAULT_REACTION_ACTIVE:
+        state = SimState::FAULT;
+        break;
+    case SimState::FAULT:
+        if (fault_reset)
+        {
+            object(0x603F) = 0;
+            state = SimState::SWITCH_ON_DISABLED;
+        }
+        break;
+    }
+}
+
+double SimSlave::commandedTorque(double target_position, double feedforward_velocity)
+{
+    constexpr double inertia = SIM_MOTOR_INERTIA + SIM_LOAD_INERTIA / (SIM_GEAR_RATIO * SIM_GEAR_RATIO);
+    constexpr double kp = inertia * SIM_POSITION_BANDWIDTH * SIM_POSITION_BANDWIDTH;
+    constexpr double kd = 2 * inertia * SIM_POSITION_BANDWIDTH;
+    constexpr double kv = inertia * SIM_VELOCITY_BANDWIDTH;
+    constexpr double rpm_to_rad_s = 2 * M_PI / 60;
+
+    if (state == SimState::QUICK_STOP_ACTIVE)
+    {
+        return -kv * motorVelocity;
+    }
+    if (state != SimState::OPERATION_ENABLED)
+    {
+        return 0;
+    }
+
+    switch ((int8_t)object(0x6060))
+    {
+    case 8: // CSP
+        return kp * (target_position - motorPosition) + kd * (feedforward_velocity - motorVelocity);
+    case 9: // CSV, target velocity in motor rpm
+        return kv * ((int32_t)object(0x60FF) * rpm_to_rad_s - motorVelocity);
+    case 10: // CST
+        return (int16_t)object(0x6071) * SIM_RATED_TORQUE / 1000;
+    default:
+        return 0;
+    }
+}
+
+void SimSlave::step(double period_s)
+{
+    constexpr double inertia = SIM_MOTOR_INERTIA + SIM_LOAD_INERTIA / (SIM_GEAR_RATIO * SIM_GEAR_RATIO);
+    constexpr double counts_to_rad = 2 * M_PI / SIM_ENCODER_COUNTS;
+
+    if (!drive)
+    {
+        return;
+    }
+
+    handleControlword();
+
+    // CSP: the drive interpolates linearly between two setpoints
+    double target_position = (int32_t)object(0x607A) * counts_to_rad;
+    if (state != SimState::OPERATION_ENABLED)
+    {
+        target_position = motorPosition;
+    }
+    double feedforward_velocity = (target_position - lastTargetPosition) / period_s;
+    double torque_limit = object(0x6073) * SIM_RATED_TORQUE / 1000;
+    double h = period_s / SIM_SUBSTEPS;
+
+    torqueLimited = false;
+    for (int sub_ctr = 1; sub_ctr <= SIM_SUBSTEPS; sub_ctr++)
+    {
+        double interpolated = lastTargetPosition + (target_position - lastTargetPosition) * sub_ctr / SIM_SUBSTEPS;
+        double torque = commandedTorque(interpolated, feedforward_velocity);
+        if (std::fabs(torque) > torque_limit)
+        {
+            torque = std::copysign(torque_limit, torque);
+            torqueLimited = true;
+        }
+        motorTorque = torque;
+
+        motorVelocity += (torque - SIM_VISCOUS_FRICTION * motorVelocity) / inertia * h;
+        motorPosition += motorVelocity * h;
+
+        // Rigid stop, the position loop winds up against it until the torque limit
+        if (hasStops && motorPosition > stopMax)
+        {
+            motorPosition = stopMax;
+            motorVelocity = std::min(motorVelocity, 0.0);
+        }
+        else if (hasStops && motorPosition < stopMin)
+        {
+            motorPosition = stopMin;
+            motorVelocity = std::max(motorVelocity, 0.0);
+        }
+    }
+    lastTargetPosition = target_position;
+
+    double following_error = std::fabs(target_position - motorPosition) / counts_to_rad;
+    if (state == SimState::OPERATION_ENABLED && (int8_t)object(0x6060) == 8 && following_error > object(0x6065))
+    {
+        fault(SIM_FOLLOWING_ERROR_CODE);
+    }
+
+    updateInputs();
+}
+
+void SimSlave::updateInputs()
+{
+    constexpr double rad_to_counts = SIM_ENCODER_COUNTS / (2 * M_PI);
+    constexpr double rad_s_to_rpm = 60 / (2 * M_PI);
+
+    uint16_t statusword = 0x0200; // remote
+    switch (state)
+    {
+    case SimState::NOT_READY:
+        break;
+    case SimState::SWITCH_ON_DISABLED:
+        statusword |= 0x0040;
+        break;
+    case SimState::READY_TO_SWITCH_ON:
+        statusword |= 0x0031;
+        break;
+    case SimState::SWITCHED_ON:
+        statusword |= 0x0033;
+        break;
+    case SimState::OPERATION_ENABLED:
+        statusword |= 0x0037;
+        break;
+    case SimState::QUICK_STOP_ACTIVE:
+        statusword |= 0x0017;
+        break;
+    case SimState::FAULT_REACTION_ACTIVE:
+        statusword |= 0x001F;
+        break;
+    case SimState::FAULT:
+        statusword |= 0x0018;
+        break;
+    }
+
+    int32_t position_counts = (int32_t)std::llround(motorPosition * rad_to_counts);
+    if (state == SimState::OPERATION_ENABLED &&
+        std::abs((int64_t)(int32_t)object(0x607A) - position_counts) <= object(0x6067))
+    {
+        statusword |= 0x0400; // target reached
+    }
+    if (torqueLimited)
+    {
+        statusword |= 0x0800; // internal limit active
+    }
+
+    int16_t torque_per_mille = (int16_t)std::lround(motorTorque / SIM_RATED_TORQUE * 1000);
+
+    object(0x6041) = statusword;
+    object(0x6061) = object(0x6060);
+    object(0x6064) = (uint32_t)position_counts;
+    object(0x606C) = (uint32_t)(int32_t)std::lround(motorVelocity * rad_s_to_rpm);
+    object(0x6077) = (uint16_t)torque_per_mille;
+    object(0x6078) = (uint16_t)torque_per_mille; // current follows torque, same rating
+}
+
+struct SimSyncManager
+{
+    ec_direction_t direction = EC_DIR_INVALID;
+    std::vector<uint16_t> pdos;
+};
+
+struct ec_sdo_request
+{
+    SimSlave *slave;
+    uint16_t index;
+    uint8_t subindex;
+    std::vector<uint8_t> data;
+    ec_request_state_t state = EC_REQUEST_UNUSED;
+    bool write = false;
+    int framesLeft = 0;
+};
+
+struct ec_slave_config
+{
+    ec_master_t *master;
+    uint16_t position;
+    uint32_t vendor_id;
+    uint32_t product_code;
+    SimSlave *slave; // nullptr if the bus has no matching slave at the position
+    SimSyncManager syncManager[SIM_SYNC_MANAGERS];
+    std::map<uint16_t, std::vector<SimPdoEntry>> pdoMapping;
+    std::vector<std::pair<uint32_t, uint16_t>> startupSdos;
+    std::vector<std::unique_ptr<ec_sdo_request>> sdoRequests;
+    uint32_t sync0CycleNs = 0;
+
+    size_t syncManagerSize(uint8_t sync_index) const;
+    bool entryOffset(uint16_t index, uint8_t subindex, uint8_t &sync_index, unsigned int &offset) const;
+};
+
+size_t ec_slave_config::syncManagerSize(uint8_t sync_index) const
+{
+    size_t bits = 0;
+    for (uint16_t pdo : syncManager[sync_index].pdos)
+    {
+        auto mapping = pdoMapping.find(pdo);
+        if (mapping == pdoMapping.end())
+        {
+            continue;
+        }
+        for (const SimPdoEntry &entry : mapping->second)
+        {
+            bits += entry.bits;
+        }
+    }
+    return bits / 8;
+}
+
+bool ec_slave_config::entryOffset(uint16_t index, uint8_t subindex, uint8_t &sync_index, unsigned int &offset) const
+{
+    for (sync_index = 0; sync_index < SIM_SYNC_MANAGERS; sync_index++)
+    {
+        unsigned int bits = 0;
+        for (uint16_t pdo : syncManager[sync_index].pdos)
+        {
+            auto mapping = pdoMapping.find(pdo);
+            if (mapping == pdoMapping.end())
+            {
+                continue;
+            }
+            for (const SimPdoEntry &entry : mapping->second)
+            {
+                if (entry.index == index && entry.subindex == subindex)
+                {
+                    offset = bits / 8;
+                    return bits % 8 == 0 && entry.bits % 8 == 0;
+                }
+                bits += entry.bits;
+            }
+        }
+    }
+    return false;
+}
+
+// One sync manager of one slave mapped into a domain
+struct SimFmmu
+{
+    ec_slave_config_t *config;
+    uint8_t syncIndex;
+    unsigned int offset;
+    size_t size;
+    ec_direction_t direction;
+};
+
+struct ec_domain
+{
+    ec_master_t *master;
+    std::vector<SimFmmu> fmmus;
+    size_t size = 0;
+    std::vector<uint8_t> internalMemory;
+    uint8_t *data = nullptr;
+    std::vector<uint8_t> frame;  // inputs latched by the frame on the wire
+    bool queued = false;
+    bool inFlight = false;
+    bool received = false;
+    unsigned int expectedWorkingCounter = 0;
+    ec_domain_state_t state = {};
+
+    unsigned int mapSyncManager(ec_slave_config_t *config, uint8_t sync_index);
+};
+
+unsigned int ec_domain::mapSyncManager(ec_slave_config_t *config, uint8_t sync_index)
+{
+    for (const SimFmmu &fmmu : fmmus)
+    {
+        if (fmmu.config == config && fmmu.syncIndex == sync_index)
+        {
+            return fmmu.offset;
+        }
+    }
+
+    SimFmmu fmmu = {config, sync_index, (unsigned int)size, config->syncManagerSize(sync_index),
+                    config->syncManager[sync_index].direction};
+    fmmus.push_back(fmmu);
+    size += fmmu.size;
+    // Like an LRW datagram: a write counts 2, a read 1
+    expectedWorkingCounter += fmmu.direction == EC_DIR_OUTPUT ? 2 : 1;
+    return fmmu.offset;
+}
+
+struct ec_master
+{
+    unsigned int index;
+    std::vector<SimSlave> slaves;
+    std::vector<std::unique_ptr<ec_slave_config>> configs;
+    std::vector<std::unique_ptr<ec_domain>> domains;
+    bool active = false;
+    uint64_t frames = 0;
+    double sendIntervalS = 0.001;
+
+    uint64_t appTimeNs = 0;
+    uint64_t referenceTimeNs = 0; // latched by the last frame
+    bool referenceValid = false;
+    ec_slave_config_t *referenceClock = nullptr;
+
+    int faultPosition = -1;
+    uint64_t faultFrame = 0;
+
+    void processSdoRequests();
+};
+
+void ec_master::processSdoRequests()
+{
+    for (std::unique_ptr<ec_slave_config> &config : configs)
+    {
+        for (std::unique_ptr<ec_sdo_request> &request : config->sdoRequests)
+        {
+            if (request->state != EC_REQUEST_BUSY || --request->framesLeft > 0)
+            {
+                continue;
+            }
+
+            SimSlave *slave = request->slave;
+            if (slave == nullptr || !slave->hasObject(request->index, request->subindex))
+            {
+                request->state = EC_REQUEST_ERROR; // abort 0x06020000, object does not exist
+                continue;
+            }
+
+            uint32_t &value = slave->object(request->index, request->subindex);
+            if (request->write)
+            {
+                uint32_t written = 0;
+                memcpy(&written, request->data.data(), std::min(request->data.size(), sizeof(written)));
+                value = le32toh(written);
+            }
+            else
+            {
+                uint32_t read = htole32(value);
+                memcpy(request->data.data(), &read, std::min(request->data.size(), sizeof(read)));
+            }
+            request->state = EC_REQUEST_SUCCESS;
+        }
+    }
+}
+
+static uint32_t readLittleEndian(const uint8_t *data, unsigned int bytes)
+{
+    uint32_t value = 0;
+    for (unsigned int byte_ctr = 0; byte_ctr < bytes; byte_ctr++)
+    {
+        value |= (uint32_t)data[byte_ctr] << (8 * byte_ctr);
+    }
+    return value;
+}
+
+static void writeLittleEndian(uint8_t *data, unsigned int bytes, uint32_t value)
+{
+    for (unsigned int byte_ctr = 0; byte_ctr < bytes; byte_ctr++)
+    {
+        data[byte_ctr] = value >> (8 * byte_ctr);
+    }
+}
+
+// Copies between a mapped sync manager and the slave's object dictionary
+template <typename Copy>
+static void forEachMappedEntry(const SimFmmu &fmmu, Copy copy)
+{
+    const ec_slave_config_t *config = fmmu.config;
+    unsigned int offset = fmmu.offset;
+    for (uint16_t pdo : config->syncManager[fmmu.syncIndex].pdos)
+    {
+        auto mapping = config->pdoMapping.find(pdo);
+        if (mapping == config->pdoMapping.end())
+        {
+            continue;
+        }
+        for (const SimPdoEntry &entry : mapping->second)
+        {
+            copy(entry, offset);
+            offset += entry.bits / 8;
+        }
+    }
+}
+
+static SimSlave *matchingSlave(ec_master_t *master, uint16_t position, uint32_t vendor_id, uint32_t product_code)
+{
+    if (position >= master->slaves.size())
+    {
+        return nullptr;
+    }
+    SimSlave &slave = master->slaves[position];
+    if (slave.vendor_id != vendor_id || slave.product_code != product_code)
+    {
+        fprintf(stderr, "ecrt_sim: slave %u is 0x%08X:0x%08X, configured as 0x%08X:0x%08X\n", position,
+                slave.vendor_id, slave.product_code, vendor_id, product_code);
+        return nullptr;
+    }
+    return &slave;
+}
+
+extern "C" {
+
+ec_master_t *ecrt_request_master(unsigned int master_index)
+{
+    ec_master_t *master = new ec_master;
+    master->index = master_index;
+
+    int drives = SIM_DEFAULT_DRIVES;
+    if (const char *env = getenv("ECRT_SIM_DRIVES"))
+    {
+        drives = std::clamp(atoi(env), 0, SIM_MAX_DRIVES);
+    }
+    if (const char *env = getenv("ECRT_SIM_FAULT"))
+    {
+        unsigned long long frame = 0;
+        if (sscanf(env, "%d:%llu", &master->faultPosition, &frame) == 2)
+        {
+            master->faultFrame = frame;
+        }
+        else
+        {
+            master->faultPosition = -1;
+        }
+    }
+
+    master->slaves.push_back({0, SIM_COUPLER_VENDOR_ID, SIM_COUPLER_PRODUCT_CODE, "EK1100 EtherCAT-Koppler (2A E-Bus)", false});
+    for (int drive_ctr = 0; drive_ctr < drives; drive_ctr++)
+    {
+        master->slaves.push_back({(uint16_t)(drive_ctr + 1), SIM_DRIVE_VENDOR_ID, SIM_DRIVE_PRODUCT_CODE, "Denali XCR (simulated)", true});
+    }
+    for (SimSlave &slave : master->slaves)
+    {
+        slave.initDictionary();
+    }
+    if (const char *env = getenv("ECRT_SIM_STOPS"))
+    {
+        const char *entry = env;
+        while (*entry != '\0')
+        {
+            int position = 0, length = 0;
+            double stop_min = 0, stop_max = 0;
+            if (sscanf(entry, "%d:%lf:%lf%n", &position, &stop_min, &stop_max, &length) != 3 ||
+                position <= 0 || position >= (int)master->slaves.size() || stop_min >= stop_max)
+            {
+                fprintf(stderr, "ecrt_sim: ignoring ECRT_SIM_STOPS from \"%s\"\n", entry);
+                break;
+            }
+
+            SimSlave &slave = master->slaves[position];
+            slave.hasStops = true;
+            slave.stopMin = stop_min * SIM_GEAR_RATIO;
+            slave.stopMax = stop_max * SIM_GEAR_RATIO;
+            printf("ecrt_sim: drive at position %d stops at %.3f and %.3f rad\n", position, stop_min, stop_max);
+
+            entry += length;
+            if (*entry == ',')
+            {
+                entry++;
+            }
+        }
+    }
+
+    printf("ecrt_sim: master %u, simulated bus with %d drive(s)\n", master_index, drives);
+    return master;
+}
+
+void ecrt_release_master(ec_master_t *master)
+{
+    delete master;
+}
+
+int ecrt_master(ec_master_t *master, ec_master_info_t *master_info)
+{
+    memset(master_info, 0, sizeof(*master_info));
+    master_info->slave_count = master->slaves.size();
+    master_info->link_up = 1;
+    master_info->scan_busy = 0;
+    master_info->app_time = master->appTimeNs;
+    return 0;
+}
+
+int ecrt_master_get_slave(ec_master_t *master, uint16_t slave_position, ec_slave_info_t *slave_info)
+{
+    if (slave_position >= master->slaves.size())
+    {
+        return -1;
+    }
+    const SimSlave &slave = master->slaves[slave_position];
+
+    memset(slave_info, 0, sizeof(*slave_info));
+    slave_info->position = slave.position;
+    slave_info->vendor_id = slave.vendor_id;
+    slave_info->product_code = slave.product_code;
+    slave_info->al_state = master->active ? 0x08 : 0x02;
+    slave_info->sync_count = slave.drive ? SIM_SYNC_MANAGERS : 0;
+    slave_info->sdo_count = slave.objects.size();
+    strncpy(slave_info->name, slave.name.c_str(), EC_MAX_STRING_LENGTH - 1);
+    return 0;
+}
+
+ec_domain_t *ecrt_master_create_domain(ec_master_t *master)
+{
+    master->domains.push_back(std::make_unique<ec_domain>());
+    master->domains.back()->master = master;
+    return master->domains.back().get();
+}
+
+ec_slave_config_t *ecrt_master_slave_config(ec_master_t *master, uint16_t alias, uint16_t position,
+                                            uint32_t vendor_id, uint32_t product_code)
+{
+    for (std::unique_ptr<ec_slave_config> &config : master->configs)
+    {
+        if (config->position == position)
+        {
+            bool same = config->vendor_id == vendor_id && config->product_code == product_code;
+            return same ? config.get() : nullptr;
+        }
+    }
+
+    std::unique_ptr<ec_slave_config> config = std::make_unique<ec_slave_config>();
+    config->master = master;
+    config->position = position;
+    config->vendor_id = vendor_id;
+    config->product_code = product_code;
+    config->slave = alias == 0 ? matchingSlave(master, position, vendor_id, product_code) : nullptr;
+    master->configs.push_back(std::move(config));
+    return master->configs.back().get();
+}
+
+int ecrt_master_select_reference_clock(ec_master_t *master, ec_slave_config_t *sc)
+{
+    master->referenceClock = sc;
+    return 0;
+}
+
+int ecrt_master_activate(ec_master_t *master)
+{
+    for (std::unique_ptr<ec_domain> &domain : master->domains)
+    {
+        if (domain->data == nullptr)
+        {
+            domain->internalMemory.assign(domain->size, 0);
+            domain->data = domain->internalMemory.data();
+        }
+        domain->frame.assign(domain->size, 0);
+    }
+
+    for (std::unique_ptr<ec_slave_config> &config : master->configs)
+    {
+        if (config->slave == nullptr)
+        {
+            continue;
+        }
+        for (const std::pair<uint32_t, uint16_t> &sdo : config->startupSdos)
+        {
+            config->slave->objects[sdo.first] = sdo.second;
+        }
+    }
+
+    master->active = true;
+    return 0;
+}
+
+int ecrt_master_deactivate(ec_master_t *master)
+{
+    master->active = false;
+    return 0;
+}
+
+int ecrt_master_set_send_interval(ec_master_t *master, size_t send_interval)
+{
+    if (send_interval == 0)
+    {
+        return -1;
+    }
+    master->sendIntervalS = send_interval * 1e-6;
+    return 0;
+}
+
+// One frame: latch the inputs, hand the outputs to the drives, let the drives
+// run for one send interval
+int ecrt_master_send(ec_master_t *master)
+{
+    if (!master->active)
+    {
+        return 0;
+    }
+
+    for (std::unique_ptr<ec_domain> &domain : master->domains)
+    {
+        if (!domain->queued)
+        {
+            continue;
+        }
+        for (const SimFmmu &fmmu : domain->fmmus)
+        {
+            SimSlave *slave = fmmu.config->slave;
+            if (slave == nullptr)
+            {
+                continue;
+            }
+            if (fmmu.direction == EC_DIR_OUTPUT)
+            {
+                forEachMappedEntry(fmmu, [&](const SimPdoEntry &entry, unsigned int offset) {
+                    slave->object(entry.index, entry.subindex) = readLittleEndian(domain->data + offset, entry.bits / 8);
+                });
+            }
+            else
+            {
+                forEachMappedEntry(fmmu, [&](const SimPdoEntry &entry, unsigned int offset) {
+                    writeLittleEndian(domain->frame.data() + offset, entry.bits / 8, slave->object(entry.index, entry.subindex));
+                });
+            }
+        }
+        domain->queued = false;
+        domain->inFlight = true;
+    }
+
+    if (master->referenceClock != nullptr && master->referenceClock->slave != nullptr)
+    {
+        // The simulated clocks do not drift, the reference clock keeps the time it was synchronized to
+        master->referenceTimeNs = master->appTimeNs;
+        master->referenceValid = true;
+    }
+
+    if (master->faultPosition >= 0 && master->frames == master->faultFrame &&
+        (size_t)master->faultPosition < master->slaves.size())
+    {
+        master->slaves[master->faultPosition].fault(SIM_INJECTED_FAULT_CODE);
+    }
+    for (SimSlave &slave : master->slaves)
+    {
+        slave.step(master->sendIntervalS);
+    }
+    master->processSdoRequests();
+    master->frames++;
+    return 0;
+}
+
+int ecrt_master_receive(ec_master_t *master)
+{
+    for (std::unique_ptr<ec_domain> &domain : master->domains)
+    {
+        if (!domain->inFlight)
+        {
+            continue;
+        }
+        for (const SimFmmu &fmmu : domain->fmmus)
+        {
+            if (fmmu.direction == EC_DIR_INPUT && fmmu.config->slave != nullptr)
+            {
+                memcpy(domain->data + fmmu.offset, domain->frame.data() + fmmu.offset, fmmu.size);
+            }
+        }
+        domain->inFlight = false;
+        domain->received = true;
+    }
+    return 0;
+}
+
+int ecrt_master_state(const ec_master_t *master, ec_master_state_t *state)
+{
+    state->slaves_responding = master->slaves.size();
+    state->al_states = master->active ? 0x08 : 0x02;
+    state->link_up = 1;
+    return 0;
+}
+
+int ecrt_master_application_time(ec_master_t *master, uint64_t app_time)
+{
+    master->appTimeNs = app_time;
+    return 0;
+}
+
+int ecrt_master_sync_reference_clock(ec_master_t *master)
+{
+    return 0;
+}
+
+int ecrt_master_sync_reference_clock_to(ec_master_t *master, uint64_t sync_time)
+{
+    return 0;
+}
+
+int ecrt_master_sync_slave_clocks(ec_master_t *master)
+{
+    return 0;
+}
+
+int ecrt_master_reference_clock_time(const ec_master_t *master, uint32_t *time)
+{
+    if (!master->referenceValid)
+    {
+        return -1;
+    }
+    *time = (uint32_t)master->referenceTimeNs;
+    return 0;
+}
+
+int ecrt_master_sync_monitor_queue(ec_master_t *master)
+{
+    return 0;
+}
+
+uint32_t ecrt_master_sync_monitor_process(const ec_master_t *master)
+{
+    return 0;
+}
+
+int ecrt_slave_config_sync_manager(ec_slave_config_t *sc, uint8_t sync_index, ec_direction_t direction,
+                                   ec_watchdog_mode_t watchdog_mode)
+{
+    if (sync_index >= SIM_SYNC_MANAGERS)
+    {
+        return -1;
+    }
+    sc->syncManager[sync_index].direction = direction;
+    return 0;
+}
+
+int ecrt_slave_config_pdo_assign_add(ec_slave_config_t *sc, uint8_t sync_index, uint16_t index)
+{
+    if (sync_index >= SIM_SYNC_MANAGERS)
+    {
+        return -1;
+    }
+    sc->syncManager[sync_index].pdos.push_back(index);
+    return 0;
+}
+
+int ecrt_slave_config_pdo_assign_clear(ec_slave_config_t *sc, uint8_t sync_index)
+{
+    if (sync_index >= SIM_SYNC_MANAGERS)
+    {
+        return -1;
+    }
+    sc->syncManager[sync_index].pdos.clear();
+    return 0;
+}
+
+int ecrt_slave_config_pdo_mapping_add(ec_slave_config_t *sc, uint16_t pdo_index, uint16_t entry_index,
+                                      uint8_t entry_subindex, uint8_t entry_bit_length)
+{
+    sc->pdoMapping[pdo_index].push_back({entry_index, entry_subindex, entry_bit_length});
+    if (sc->slave != nullptr && entry_index != 0)
+    {
+        sc->slave->object(entry_index, entry_subindex); // mapped objects exist in the dictionary
+    }
+    return 0;
+}
+
+int ecrt_slave_config_pdo_mapping_clear(ec_slave_config_t *sc, uint16_t pdo_index)
+{
+    sc->pdoMapping[pdo_index].clear();
+    return 0;
+}
+
+int ecrt_slave_config_sdo16(ec_slave_config_t *sc, uint16_t index, uint8_t subindex, uint16_t value)
+{
+    sc->startupSdos.push_back({objectKey(index, subindex), value});
+    return 0;
+}
+
+int ecrt_slave_config_dc(ec_slave_config_t *sc, uint16_t assign_activate, uint32_t sync0_cycle,
+                         int32_t sync0_shift, uint32_t sync1_cycle, int32_t sync1_shift)
+{
+    sc->sync0CycleNs = assign_activate ? sync0_cycle : 0;
+    return 0;
+}
+
+ec_sdo_request_t *ecrt_slave_config_create_sdo_request(ec_slave_config_t *sc, uint16_t index, uint8_t subindex,
+                                                       size_t size)
+{
+    std::unique_ptr<ec_sdo_request> request = std::make_unique<ec_sdo_request>();
+    request->slave = sc->slave;
+    request->index = index;
+    request->subindex = subindex;
+    request->data.assign(size, 0);
+    sc->sdoRequests.push_back(std::move(request));
+    return sc->sdoRequests.back().get();
+}
+
+int ecrt_domain_reg_pdo_entry_list(ec_domain_t *domain, const ec_pdo_entry_reg_t *pdo_entry_regs)
+{
+    for (const ec_pdo_entry_reg_t *reg = pdo_entry_regs; reg->index; reg++)
+    {
+        ec_slave_config_t *sc = ecrt_master_slave_config(domain->master, reg->alias, reg->position,
+                                                         reg->vendor_id, reg->product_code);
+        uint8_t sync_index;
+        unsigned int entry_offset;
+        if (sc == nullptr || !sc->entryOffset(reg->index, reg->subindex, sync_index, entry_offset))
+        {
+            fprintf(stderr, "ecrt_sim: 0x%04X:%02X of slave %u is not mapped byte aligned\n", reg->index,
+                    reg->subindex, reg->position);
+            return -1;
+        }
+
+        *reg->offset = domain->mapSyncManager(sc, sync_index) + entry_offset;
+        if (reg->bit_position)
+        {
+            *reg->bit_position = 0;
+        }
+    }
+    return 0;
+}
+
+size_t ecrt_domain_size(const ec_domain_t *domain)
+{
+    return domain->size;
+}
+
+void ecrt_domain_external_memory(ec_domain_t *domain, uint8_t *memory)
+{
+    domain->data = memory;
+}
+
+uint8_t *ecrt_domain_data(ec_domain_t *domain)
+{
+    return domain->master->active ? domain->data : nullptr;
+}
+
+int ecrt_domain_process(ec_domain_t *domain)
+{
+    bool complete = domain->received;
+    for (const SimFmmu &fmmu : domain->fmmus)
+    {
+        complete = complete && fmmu.config->slave != nullptr;
+    }
+
+    unsigned int working_counter = 0;
+    if (domain->received)
+    {
+        for (const SimFmmu &fmmu : domain->fmmus)
+        {
+            if (fmmu.config->slave != nullptr)
+            {
+                working_counter += fmmu.direction == EC_DIR_OUTPUT ? 2 : 1;
+            }
+        }
+    }
+
+    domain->state.working_counter = working_counter;
+    domain->state.wc_state = complete ? EC_WC_COMPLETE : (working_counter ? EC_WC_INCOMPLETE : EC_WC_ZERO);
+    domain->received = false;
+    return 0;
+}
+
+int ecrt_domain_queue(ec_domain_t *domain)
+{
+    domain->queued = true;
+    return 0;
+}
+
+int ecrt_domain_state(const ec_domain_t *domain, ec_domain_state_t *state)
+{
+    *state = domain->state;
+    return 0;
+}
+
+int ecrt_sdo_request_index(ec_sdo_request_t *req, uint16_t index, uint8_t subindex)
+{
+    req->index = index;
+    req->subindex = subindex;
+    return 0;
+}
+
+int ecrt_sdo_request_timeout(ec_sdo_request_t *req, uint32_t timeout)
+{
+    return 0;
+}
+
+uint8_t *ecrt_sdo_request_data(ec_sdo_request_t *req)
+{
+    return req->data.data();
+}
+
+size_t ecrt_sdo_request_data_size(const ec_sdo_request_t *req)
+{
+    return req->data.size();
+}
+
+ec_request_state_t ecrt_sdo_request_state(ec_sdo_request_t *req)
+{
+    return req->state;
+}
+
+int ecrt_sdo_request_write(ec_sdo_request_t *req)
+{
+    req->write = true;
+    req->state = EC_REQUEST_BUSY;
+    req->framesLeft = SIM_SDO_FRAMES;
+    return 0;
+}
+
+int ecrt_sdo_request_read(ec_sdo_request_t *req)
+{
+    req->write = false;
+    req->state = EC_REQUEST_BUSY;
+    req->framesLeft = SIM_SDO_FRAMES;
+    return 0;
+}
+
+} // extern "C"
@@ -6,47 +6,50 @@ void EthercatMaster::transitionToState(ControlWordValues value, int jnt_ctr)
     EC_WRITE_U16(domainPd + driveOffset[jnt_ctr].controlword, value);
 }
 
-StatusWordValues EthercatMaster::readDriveState(int joint_num)
+// One pass over all statuswords right after the process image is received,
+// the drive state handlers below only look at driveStatus[]
+void EthercatMaster::decode_drive_status()
 {
-    uint16_t drive_status = EC_READ_U16(domainPd + driveOffset[joint_num].statusword);
-
-    // cout << "update_state" << endl;
-    if (((drive_status | 65456) ^ 65456) == 0)
-    {
-        std::cout<<"Drive not ready to Switch on \n";
-        return StatusWordValues::SW_NOT_READY_TO_SWITCH_ON;
-    }
-    else if (((drive_status | 65456) ^ 65520) == 0)
-    {
-        return StatusWordValues::SW_SWITCH_ON_DISABLED;
-    }
-    else if (((drive_status | 65424) ^ 65457) == 0)
-    {
-        return StatusWordValues::SW_READY_TO_SWITCH_ON;
-    }
-    else if (((drive_status | 65424) ^ 65459) == 0)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        return StatusWordValues::SW_SWITCHED_ON;
+        DriveStatus status = decodeStatusword(EC_READ_U16(domainPd + driveOffset[jnt_ctr].statusword));
+
+        if (status.state != driveStatus[jnt_ctr].state)
+        {
+            switch (status.state)
+            {
+            case Cia402State::FAULT:
+                faultCodePending[jnt_ctr] = true; // the error code is read with the diagnostics
+                break;
+            case Cia402State::FAULT_REACTION_ACTIVE:
+                rtLog.error("Drive %d is in fault reaction active", jnt_ctr);
+                break;
+            case Cia402State::UNKNOWN:
+                rtLog.error("Drive %d reports unknown statusword 0x%04X", jnt_ctr, status.statusword);
+                break;
+            case Cia402State::NOT_READY_TO_SWITCH_ON:
+                rtLog.warn("Drive %d not ready to switch on", jnt_ctr);
+                break;
+            default:
+                break;
+            }
+        }
+        driveStatus[jnt_ctr] = status;
     }
-    else if (((drive_status | 65424) ^ 65463) == 0)
+
+    if (cycleStage)
     {
-        return StatusWordValues::SW_OPERATION_ENABLED;
+        std::copy_n(driveStatus, numJoints, stageFeedback.drive_status);
+        return;
     }
-    else if (((drive_status | 65456) ^ 65471) == 0)
+
+    if (processImagePtr != nullptr)
     {
-        // Fault Reaction Active
-        std::cout<<"Drive is in Fault reaction Active \n";
-        return StatusWordValues::SW_FAULT_REACTION_ACTIVE;
+        // Consumers decode the statusword from the exported process image themselves
+        return;
     }
-    else if (((drive_status | 65456) ^ 65464) == 0)
-    {
-        // Fault
-        std::cout<<"Drive is in Fault \n";
-        std::cout<<"error code : "<<EC_READ_U16(domainPd + driveOffset[joint_num].error_code)<<std::endl;
 
-        return StatusWordValues::SW_FAULT;
-    }
-    else{
-        return StatusWordValues::SW_NOT_READY_TO_SWITCH_ON;
-    }
-}
\ No newline at end of file
+    jointDataPtr->feedback_lock.writeBegin();
+    std::copy_n(driveStatus, numJoints, jointDataPtr->drive_status);
+    jointDataPtr->feedback_lock.writeEnd();
+}
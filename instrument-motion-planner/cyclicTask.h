@@ -2,20 +2,38 @@
 
 #include "instrument_jog.h"
 #include "sterile_engagement.h"
+#include "sterile_engagement3.h"
 
 void InstrumentMotionPlanner::cyclicTask()
 {
-    // struct period_info pinfo;
-
-    // periodic_task_init(&pinfo);
+    periodic_task_init(&cycleInfo, DEFAULT_CYCLE_PERIOD_NS);
+    follow_cycle_period();
+    pageFaults.start();
+    cycleMonitor.start(&cycleStatsPtr->planner);
+    safetyCycleSeen = appDataPtr->safety_cycle.current();
 
     while (!exitFlag)
     {
         do_rt_task();
-        // wait_rest_of_period(&pinfo);
+        wait_for_cycle();
     }
 }
 
+void InstrumentMotionPlanner::start()
+{
+    rtLog.start("instrument_motion_planner");
+    periodic_task_init(&cycleInfo, DEFAULT_CYCLE_PERIOD_NS);
+    follow_cycle_period();
+    appDataPtr->planner_ready.set();
+}
+
+void InstrumentMotionPlanner::cycle(Setpoint &setpoint)
+{
+    stageSetpoint = &setpoint;
+    follow_cycle_period();
+    do_rt_task();
+}
+
 void InstrumentMotionPlanner::inc_period(struct period_info *pinfo)
 {
 
@@ -29,10 +47,9 @@ void InstrumentMotionPlanner::inc_period(struct period_info *pinfo)
     }
 }
 
-void InstrumentMotionPlanner::periodic_task_init(struct period_info *pinfo)
+void InstrumentMotionPlanner::periodic_task_init(struct period_info *pinfo, long period_ns)
 {
-    /* for simplicity, hardcoding a 1ms period */
-    pinfo->period_ns = 1000000;
+    pinfo->period_ns = period_ns;
 
     clock_gettime(CLOCK_MONOTONIC, &(pinfo->next_period));
 }
@@ -66,26 +83,28 @@ void InstrumentMotionPlanner::do_rt_task()
         appDataPtr->switch_to_operation = true;
         if (appDataPtr->operation_enable_status)
         {
-            if (commandDataPtr->type != CommandType::NONE)
+            // One command per cycle, the rest stay queued
+            if (commandQueuePtr->pop(activeCommand) && activeCommand.type != CommandType::NONE)
             {
-                systemDataPtr->setSystemState(SystemState::IN_EXECUTION);
+                if (start_command())
+                {
+                    systemDataPtr->setSystemState(SystemState::IN_EXECUTION);
+                }
+                else
+                {
+                    activeCommand.setNone();
+                }
             }
         }
         break;
     case SystemState::IN_EXECUTION:
         // std::cout<<"sys state powered in execution \n";
-        if (commandDataPtr->type == CommandType::JOG)
-        {
-            Jog();
-        }
-        else if (commandDataPtr->type == CommandType::HAND_CONTROL)
+        if (!step_command())
         {
-            sterile_engagement();
+            procedure.reset();
+            activeCommand.setNone();
+            systemDataPtr->setSystemState(SystemState::READY);
         }
-        else
-        {
-        }
-        systemDataPtr->setSystemState(SystemState::READY);
         break;
     case SystemState::RECOVERY:
         // std::cout<<"sys state in recovery \n";
@@ -101,15 +120,146 @@ void InstrumentMotionPlanner::do_rt_task()
     default:
         break;
     }
+}
+
+// Returns false for commands the planner cannot execute, they are dropped in READY
+bool InstrumentMotionPlanner::start_command()
+{
+    if (activeCommand.type == CommandType::JOG)
+    {
+        appDataPtr->drive_operation_mode = OperationModeState::POSITION_MODE;
+    }
+    else if (activeCommand.type == CommandType::HAND_CONTROL)
+    {
+        start_procedure(sterile_engagement());
+    }
+    else
+    {
+        // MOVE_TO has three goal positions for four joints, not executed until that is defined
+        rtLog.warn("Command %lu rejected, command type %d is not supported", activeCommand.sequence, (int)activeCommand.type);
+        return false;
+    }
+    return true;
+}
+
+// Advances the active command by one cycle, errors and aborts stop it before it writes again
+bool InstrumentMotionPlanner::step_command()
+{
+    if (appDataPtr->trigger_error || !appDataPtr->operation_enable_status)
+    {
+        rtLog.warn("Command %lu stopped, operation is no longer enabled", activeCommand.sequence);
+        return false;
+    }
+
+    // A queued NONE aborts, READY takes it off the queue
+    Command next;
+    if (commandQueuePtr->peek(next) && next.type == CommandType::NONE)
+    {
+        rtLog.info("Command %lu aborted", activeCommand.sequence);
+        return false;
+    }
+
+    if (activeCommand.type == CommandType::JOG)
+    {
+        return step_jog();
+    }
+    else if (activeCommand.type == CommandType::HAND_CONTROL)
+    {
+        return step_procedure();
+    }
+    return false;
+}
 
-    usleep(1000);
+// Procedures start from where the joints are when the command is taken
+void InstrumentMotionPlanner::start_procedure(Procedure started)
+{
+    std::copy_n(appDataPtr->actual_position, JOINTS_PER_INSTRUMENT, procedureCommand);
+    procedureTime = 0;
+    procedure = std::move(started);
+}
+
+bool InstrumentMotionPlanner::step_procedure()
+{
+    procedureTime = procedureTime + cycleTime;
+    bool running = procedure.resume();
+    if (procedure.failed())
+    {
+        rtLog.error("Command %lu stopped, no procedure frame left", activeCommand.sequence);
+        return false;
+    }
 
+    write_to_drive(procedureCommand);
+    return running;
 }
 
 void InstrumentMotionPlanner::wait_rest_of_period(struct period_info *pinfo)
 {
-    inc_period(pinfo);
+    cycleMonitor.advance(pinfo->next_period, pinfo->period_ns);
 
     /* for simplicity, ignoring possibilities of signal wakes */
     clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pinfo->next_period, NULL);
 }
+
+// The safety controller may start after us, pick its period up once it is published
+void InstrumentMotionPlanner::follow_cycle_period()
+{
+    uint32_t period_ns = appDataPtr->cycle_period_ns;
+    if ((long)period_ns != cycleInfo.period_ns && isSupportedCyclePeriod(period_ns))
+    {
+        cycleInfo.period_ns = period_ns;
+        cycleTime = period_ns * 1e-9;
+        rtLog.info("Cycle period %u us", period_ns / 1000);
+    }
+}
+
+void InstrumentMotionPlanner::wait_for_cycle()
+{
+    pageFaults.tick(rtLog);
+    cycleMonitor.sleep(cycleInfo.period_ns);
+    follow_cycle_period();
+
+    // The safety controller clears AppData in ERROR, stay in lockstep once entered
+    if (!simulationMode && appDataPtr->simulation_mode)
+    {
+        simulationMode = true;
+        rtLog.info("Lockstep simulation, cycles follow the safety controller");
+    }
+
+    if (simulationMode)
+    {
+        // Answer the request this cycle ran for and wait for the next one, no deadline
+        appDataPtr->planner_cycle.acknowledge(safetyCycleSeen);
+        appDataPtr->safety_cycle.waitPast(safetyCycleSeen, exitFlag);
+        safetyCycleSeen = appDataPtr->safety_cycle.current();
+        cycleMonitor.wakeOnEvent();
+        return;
+    }
+
+    if (!phaseLock)
+    {
+        wait_rest_of_period(&cycleInfo);
+        cycleMonitor.wake(cycleInfo.next_period);
+        return;
+    }
+
+    // This cycle's setpoint is published, let the safety controller apply it
+    appDataPtr->planner_cycle.signal();
+
+    // Wake on the safety controller's next cycle, fall back to our own clock half a period late
+    cycleMonitor.advance(cycleInfo.next_period, cycleInfo.period_ns);
+
+    struct period_info deadline = cycleInfo;
+    deadline.period_ns = cycleInfo.period_ns / 2;
+    inc_period(&deadline);
+
+    if (appDataPtr->safety_cycle.wait(safetyCycleSeen, &deadline.next_period))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &(cycleInfo.next_period));
+        cycleMonitor.wakeOnEvent();
+    }
+    else
+    {
+        cycleMonitor.wake(deadline.next_period);
+    }
+    safetyCycleSeen = appDataPtr->safety_cycle.current();
+}
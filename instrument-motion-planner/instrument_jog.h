@@ -7,19 +7,19 @@ double InstrumentMotionPlanner::jog(int index, int dir, int type)
     if (type == 0) // joint space
     {
         /* code */
-        double command_pos[NUM_JOINTS];
-        double command_vel[NUM_JOINTS] = {0, 0, 0, 0};
-        std::copy(std::begin(appDataPtr->actual_position), std::end(appDataPtr->actual_position), std::begin(command_pos));
+        double command_pos[JOINTS_PER_INSTRUMENT];
+        double command_vel[JOINTS_PER_INSTRUMENT] = {0, 0, 0, 0};
+        std::copy_n(appDataPtr->actual_position, JOINTS_PER_INSTRUMENT, command_pos);
         command_pos[index] = appDataPtr->actual_position[index] + dir * 0.01;
         write_to_drive(command_pos);
     }
     else if (type == 1)// task space
     {
         double vel = 4.0;
-        double ini_pos[NUM_JOINTS];
-        double final_pos[NUM_JOINTS];
+        double ini_pos[JOINTS_PER_INSTRUMENT];
+        double final_pos[JOINTS_PER_INSTRUMENT];
         double time = 0;
-        for (int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+        for (int jnt_ctr = 0; jnt_ctr < JOINTS_PER_INSTRUMENT; jnt_ctr++)
         {
             ini_pos[jnt_ctr] = appDataPtr->actual_position[jnt_ctr];
             final_pos[jnt_ctr] = ini_pos[jnt_ctr];
@@ -111,10 +111,9 @@ double InstrumentMotionPlanner::jog(int index, int dir, int type)
     return 1;
 }
 
-void InstrumentMotionPlanner::Jog()
+// Jogs one step per cycle until the client queues the next command
+bool InstrumentMotionPlanner::step_jog()
 {
-    appDataPtr->drive_operation_mode = OperationModeState::POSITION_MODE;
-
     // if (commandDataPtr->jog_data.type == 0 && appDataPtr->trigger_error == false)
     // {
     //     jog(commandDataPtr->jog_data.index, commandDataPtr->jog_data.dir, 0);
@@ -125,19 +124,11 @@ void InstrumentMotionPlanner::Jog()
     //     jog(commandDataPtr->jog_data.index, commandDataPtr->jog_data.dir, 1);
     // }
 
-    while (commandDataPtr->jog_data.type == 0)
+    if (!commandQueuePtr->empty() || (activeCommand.jog_data.type != 0 && activeCommand.jog_data.type != 1))
     {
-        jog(commandDataPtr->jog_data.index, commandDataPtr->jog_data.dir, 0);
-        if (appDataPtr->trigger_error)
-            break;
+        return false;
     }
 
-    while (commandDataPtr->jog_data.type == 1)
-    {
-        jog(commandDataPtr->jog_data.index, commandDataPtr->jog_data.dir, 1);
-        if (appDataPtr->trigger_error)
-            break;
-    }
-
-    commandDataPtr->type = CommandType::NONE;
-}
\ No newline at end of file
+    jog(activeCommand.jog_data.index, activeCommand.jog_data.dir, activeCommand.jog_data.type);
+    return true;
+}
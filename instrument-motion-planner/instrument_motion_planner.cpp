@@ -2,11 +2,32 @@
 // #include "sterile_engagement.h"
 
 
-int main(){
+#ifndef INSTRUMENT_RT
+int main(int argc, char **argv){
     InstrumentMotionPlanner motion_planner;
+
+    for (int arg_ctr = 1; arg_ctr < argc; arg_ctr++)
+    {
+        if (strcmp(argv[arg_ctr], "--phase-lock") == 0)
+        {
+            motion_planner.enablePhaseLock();
+        }
+        else if (strcmp(argv[arg_ctr], "--overrun-policy") == 0 && arg_ctr + 1 < argc)
+        {
+            OverrunPolicy policy;
+            if (!parseOverrunPolicy(argv[++arg_ctr], policy))
+            {
+                fprintf(stderr, "Unknown overrun policy %s, use skip, reanchor or catch-up.\n", argv[arg_ctr]);
+                return 1;
+            }
+            motion_planner.setOverrunPolicy(policy);
+        }
+    }
+
     motion_planner.run();
     return 0;
 }
+#endif
 
 InstrumentMotionPlanner::InstrumentMotionPlanner(){
     configureSharedMemory();
@@ -17,6 +38,9 @@ InstrumentMotionPlanner::~InstrumentMotionPlanner(){
 
 void InstrumentMotionPlanner::run(){
 
+    // Started before the affinity and priority changes below so it stays a normal thread
+    rtLog.start("instrument_motion_planner");
+
     // Set CPU affinity for real-time thread
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);
@@ -48,7 +72,9 @@ void InstrumentMotionPlanner::run(){
         perror("sched_setscheduler failed");
     }
 
+    appDataPtr->planner_ready.set();
     cyclicTask();
+    rtLog.stop();
 
 }
 
@@ -69,61 +95,51 @@ void InstrumentMotionPlanner::signalHandler(int signum)
 
 void InstrumentMotionPlanner::configureSharedMemory()
 {
-    int shm_fd_systemData;
-    int shm_fd_appData;
-    int shm_fd_commandData;
-    int shm_fd_forceDimData;
-
-    createSharedMemory(shm_fd_systemData, "SystemData", sizeof(SystemData));
-    createSharedMemory(shm_fd_appData, "AppData", sizeof(AppData));
-    createSharedMemory(shm_fd_commandData, "CommandData", sizeof(CommandData));
-    createSharedMemory(shm_fd_forceDimData, "ForceDimData", sizeof(ForceDimData));
-
-    mapSharedMemory((void *&)systemDataPtr, shm_fd_systemData, sizeof(SystemData));
-    mapSharedMemory((void *&)appDataPtr, shm_fd_appData, sizeof(AppData));
-    mapSharedMemory((void *&)commandDataPtr, shm_fd_commandData, sizeof(CommandData));
-    mapSharedMemory((void *&)forceDataPtr, shm_fd_forceDimData, sizeof(ForceDimData));
+    systemDataPtr = mapSegment<SystemData>("SystemData");
+    appDataPtr = mapSegment<AppData>("AppData");
+    commandQueuePtr = mapSegment<CommandQueue>("CommandQueue");
+    forceDataPtr = mapSegment<ForceDimData>("ForceDimData");
+    cycleStatsPtr = mapSegment<CycleStats>("CycleStats");
 
     initializeSharedData();
 }
 
-void InstrumentMotionPlanner::createSharedMemory(int &shm_fd, const char *name, int size)
-{
-    shm_fd = shm_open(name, O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1)
-    {
-        throw std::runtime_error("Failed to create shared memory object.");
-    }
-    ftruncate(shm_fd, size);
-}
-
-void InstrumentMotionPlanner::mapSharedMemory(void *&ptr, int shm_fd, int size)
-{
-    ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (ptr == MAP_FAILED)
-    {
-        throw std::runtime_error("Failed to map shared memory.");
-    }
-}
-
 void InstrumentMotionPlanner::initializeSharedData()
 {
-    // systemDataPtr->setZero();
     appDataPtr->setZero();
     // commandDataPtr->setZero();
-    systemDataPtr->setSystemState(SystemState::POWER_OFF);
-    systemDataPtr->request = 0;
+    systemDataPtr->setZero();
     appDataPtr->setZero();
-    commandDataPtr->type = CommandType::NONE;
+    appDataPtr->setpoint.setZero();
+    appDataPtr->safety_cycle.reset();
+    appDataPtr->planner_cycle.reset();
+    appDataPtr->planner_ready.reset();
+    commandQueuePtr->setZero();
+    activeCommand.setNone();
     forceDataPtr->setZero();
 }
 
-int InstrumentMotionPlanner::write_to_drive(double joint_pos[NUM_JOINTS])
+int InstrumentMotionPlanner::write_to_drive(double joint_pos[JOINTS_PER_INSTRUMENT])
 {
-    for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    // Publish the whole setpoint vector at once, the safety controller only ever sees complete ones
+    Setpoint &setpoint = stageSetpoint != nullptr ? *stageSetpoint : appDataPtr->setpoint.back();
+
+    // Only the first instrument is planned here, the other drives on the bus keep their current target
+    std::copy_n(joint_pos, JOINTS_PER_INSTRUMENT, setpoint.position);
+    std::copy(appDataPtr->target_position + JOINTS_PER_INSTRUMENT, appDataPtr->target_position + MAX_JOINTS,
+              setpoint.position + JOINTS_PER_INSTRUMENT);
+    std::fill_n(setpoint.velocity, MAX_JOINTS, 0.0);
+    std::fill_n(setpoint.torque, MAX_JOINTS, 0.0);
+    setpoint.mode = appDataPtr->drive_operation_mode;
+    setpoint.feedback_timestamp_ns = appDataPtr->feedback_timestamp_ns;
+
+    if (stageSetpoint != nullptr)
     {
-        appDataPtr->target_position[jnt_ctr] = joint_pos[jnt_ctr];
+        // Stepped inline by the safety controller, which sees the new sequence once we return
+        setpoint.sequence++;
+        return 0;
     }
+    appDataPtr->setpoint.publish();
     return 0;
 }
 
@@ -1,6 +1,8 @@
 #pragma once
 
-#include "SharedObject.h"
+#include "SharedMemory.h"
+#include "ExitFlag.h"
+#include "procedure.h"
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/shm.h>
@@ -14,7 +16,27 @@
                                      guranteed safe to access without \
                                      faulting */
 
-volatile sig_atomic_t exitFlag = 0;
+constexpr double HOMING_SPEED = 1.0; // rad/s while searching the sterile adapter end stops
+
+constexpr double CONTACT_LAG = 0.05;  // rad the feedback lags the command by once a joint is against a stop
+
+// One joint searching for a stop, see move_until_contact()
+struct Contact
+{
+    int joint;
+    int dir;
+    bool hold = true; // command the contact position once found, otherwise the command stays where it stopped
+    bool found = false;
+    double position = 0;
+};
+
+// until() predicate, holds once time has reached end
+struct TimeReached
+{
+    const double &time;
+    double end;
+    bool operator()() const { return time >= end; }
+};
 
 class InstrumentMotionPlanner
 {
@@ -23,25 +45,56 @@ public:
     ~InstrumentMotionPlanner();
     void run();
 
+    // For hosting the planner in another process's cycle, run() does the same on its own clock.
+    // cycle() writes this cycle's setpoint, if any, straight into setpoint instead of AppData.
+    void start();
+    void cycle(Setpoint &setpoint);
+    void stop() { rtLog.stop(); }
+
+    void enablePhaseLock() { phaseLock = true; }
+    void setOverrunPolicy(OverrunPolicy policy) { cycleMonitor.policy = policy; }
+
 private:
     SystemData *systemDataPtr;
     AppData *appDataPtr;
-    CommandData *commandDataPtr;
+    CommandQueue *commandQueuePtr;
     ForceDimData *forceDataPtr;
+    CycleStats *cycleStatsPtr;
+    Command activeCommand;
+    Setpoint *stageSetpoint = nullptr; // set by cycle(), write_to_drive() fills it in place of AppData::setpoint
 
     void stackPrefault();
     void cyclicTask();
     static void signalHandler(int signum);
 
-    // double sterile_engagement();
-    // int pt_to_pt_mvmt(double ini_pos[NUM_JOINTS], double final_pos[NUM_JOINTS]);
+    // Each command is advanced exactly once per cycle, step_* return false once it is over
+    bool start_command();
+    bool step_command();
+
     double jog(int index, int dir, int type);
-    void Jog();
-    double sterile_engagement();
-    int write_to_drive(double joint_pos[4]);
+    bool step_jog();
+
+    // Procedures command procedureCommand, step_procedure() sends it every cycle
+    Procedure procedure;
+    double procedureCommand[JOINTS_PER_INSTRUMENT];
+    double procedureTime = 0; // seconds since the procedure started
+    void start_procedure(Procedure started);
+    bool step_procedure();
+
+    Procedure move_until_contact(Contact *contacts, int count);
+    Procedure move_until_contact(Contact &contact) { return move_until_contact(&contact, 1); }
+    Procedure hold(double seconds);
+    Procedure sterile_engagement();
+    Procedure sweep(const double ini_pos[JOINTS_PER_INSTRUMENT], const double direction[JOINTS_PER_INSTRUMENT], double movement, double time);
+    Procedure scripted_motions();
+
+    // Not built until MOVE_TO is supported, see pt_to_pt_planner.h
+    // PointToPointState ptToPt;
+    // void start_pt_to_pt(const double ini_pos[JOINTS_PER_INSTRUMENT], const double final_pos[JOINTS_PER_INSTRUMENT]);
+    // bool step_pt_to_pt();
+
+    int write_to_drive(double joint_pos[JOINTS_PER_INSTRUMENT]);
     void configureSharedMemory();
-    void createSharedMemory(int &shm_fd, const char *name, int size);
-    void mapSharedMemory(void *&ptr, int shm_fd, int size);
     void initializeSharedData();
 
     struct period_info
@@ -51,8 +104,21 @@ private:
     };
 
     static void inc_period(struct period_info *pinfo);
-    static void periodic_task_init(struct period_info *pinfo);
+    static void periodic_task_init(struct period_info *pinfo, long period_ns);
     void do_rt_task();
-    static void wait_rest_of_period(struct period_info *pinfo);
+    void wait_rest_of_period(struct period_info *pinfo);
+
+    // Cycle timing, either our own clock or phase locked to the safety controller
+    bool phaseLock = false;
+    bool simulationMode = false; // lockstep simulation, kept once entered
+    uint32_t safetyCycleSeen = 0;
+    struct period_info cycleInfo;
+    double cycleTime = DEFAULT_CYCLE_PERIOD_NS * 1e-9; // seconds, follows the safety controller
+    PageFaultMonitor pageFaults;
+    RtLogger rtLog;
+    CycleMonitor cycleMonitor;
+
+    void follow_cycle_period();
+    void wait_for_cycle();
 
 };
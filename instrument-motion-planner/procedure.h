@@ -0,0 +1,205 @@
+#pragma once
+
+// Procedures are C++20 coroutines advanced once per planner cycle. Each
+// resume() runs the procedure up to its next co_await:
+//
+//   co_await next_cycle();              // continue in the next cycle
+//   co_await until([&] { return ...; }); // continue in the first cycle the predicate holds
+//   co_await other_procedure(...);       // run a nested procedure to completion, same cycle
+//
+// Frames come from a fixed pool, never the heap; a procedure that finds the
+// pool exhausted fails instead of starting.
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <utility>
+
+constexpr size_t PROCEDURE_FRAME_SIZE = 2048;
+constexpr int PROCEDURE_FRAME_SLOTS = 4; // deepest nesting of procedures
+
+class ProcedureFramePool
+{
+public:
+    void *allocate(size_t size)
+    {
+        if (size > PROCEDURE_FRAME_SIZE)
+        {
+            return nullptr;
+        }
+        for (int slot = 0; slot < PROCEDURE_FRAME_SLOTS; slot++)
+        {
+            if (!used[slot])
+            {
+                used[slot] = true;
+                return frames[slot];
+            }
+        }
+        return nullptr;
+    }
+
+    void release(void *frame)
+    {
+        for (int slot = 0; slot < PROCEDURE_FRAME_SLOTS; slot++)
+        {
+            if (frames[slot] == frame)
+            {
+                used[slot] = false;
+            }
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char frames[PROCEDURE_FRAME_SLOTS][PROCEDURE_FRAME_SIZE];
+    bool used[PROCEDURE_FRAME_SLOTS] = {};
+};
+
+// Procedures only run on the planner's thread, one planner per process
+inline ProcedureFramePool procedureFrames;
+
+class Procedure
+{
+public:
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle_type finished) noexcept
+        {
+            // Hand the cycle back to the procedure that awaited this one
+            promise_type &promise = finished.promise();
+            if (promise.continuation)
+            {
+                promise.root->active = promise.continuation;
+                return promise.continuation;
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type
+    {
+        Procedure get_return_object()
+        {
+            active = handle_type::from_promise(*this);
+            return Procedure(handle_type::from_promise(*this));
+        }
+        static Procedure get_return_object_on_allocation_failure() { return Procedure(); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+        void return_void() const {}
+        void unhandled_exception() const { std::terminate(); }
+
+        static void *operator new(size_t size) noexcept { return procedureFrames.allocate(size); }
+        static void operator delete(void *frame, size_t) noexcept { procedureFrames.release(frame); }
+
+        promise_type *root = this;
+        std::coroutine_handle<> continuation; // the procedure awaiting this one, if nested
+
+        // Kept by the outermost procedure only
+        std::coroutine_handle<> active; // innermost procedure, resumed next cycle
+        bool (*poll)(void *) = nullptr; // until() predicate that has to hold first
+        void *pollArg = nullptr;
+        bool failed = false;            // a nested procedure found no frame
+    };
+
+    Procedure() = default;
+    explicit Procedure(handle_type handle) : handle(handle) {}
+    Procedure(Procedure &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Procedure &operator=(Procedure &&other) noexcept
+    {
+        reset();
+        handle = std::exchange(other.handle, nullptr);
+        return *this;
+    }
+    Procedure(const Procedure &) = delete;
+    Procedure &operator=(const Procedure &) = delete;
+    ~Procedure() { reset(); }
+
+    void reset()
+    {
+        if (handle)
+        {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+    // Runs one cycle, returns false once the procedure has finished or failed
+    bool resume()
+    {
+        if (failed() || handle.done())
+        {
+            return false;
+        }
+
+        promise_type &root = handle.promise();
+        if (root.poll && !root.poll(root.pollArg))
+        {
+            return true;
+        }
+        root.poll = nullptr;
+        root.active.resume();
+        return !failed() && !handle.done();
+    }
+
+    bool failed() const { return !handle || handle.promise().failed; }
+
+    // Awaited from another procedure: runs it nested, in the awaiting procedure's cycles
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(handle_type parent) noexcept
+    {
+        promise_type *root = parent.promise().root;
+        if (!handle)
+        {
+            root->failed = true;
+            return std::noop_coroutine();
+        }
+
+        promise_type &child = handle.promise();
+        child.root = root;
+        child.continuation = parent;
+        root->active = handle;
+        return handle;
+    }
+    void await_resume() const noexcept {}
+
+private:
+    handle_type handle;
+};
+
+inline std::suspend_always next_cycle()
+{
+    return {};
+}
+
+template <typename Predicate>
+class Until
+{
+public:
+    explicit Until(Predicate predicate) : predicate(std::move(predicate)) {}
+
+    bool await_ready() { return predicate(); }
+    void await_suspend(Procedure::handle_type waiting) noexcept
+    {
+        // Checked before each resume, the procedure stays suspended while it is false
+        Procedure::promise_type *root = waiting.promise().root;
+        root->poll = &Until::check;
+        root->pollArg = this;
+    }
+    void await_resume() const noexcept {}
+
+private:
+    Predicate predicate;
+
+    static bool check(void *until) { return static_cast<Until *>(until)->predicate(); }
+};
+
+template <typename Predicate>
+Until<Predicate> until(Predicate predicate)
+{
+    return Until<Predicate>(std::move(predicate));
+}
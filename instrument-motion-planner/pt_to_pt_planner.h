@@ -1,19 +1,32 @@
 #pragma once
 
-using namespace std;
-
 #include "instrument_motion_planner.h"
 
-int InstrumentMotionPlanner::pt_to_pt_mvmt(double ini_pos[NUM_JOINTS], double final_pos[4])
-{
+// Not included in the build: MOVE_TO is rejected until its goal covers all
+// joints (MoveToCommand has three goal positions, the instrument four joints)
 
-    int num_joints = 4;
+// Trapezoidal point to point profile, sampled once per cycle
+struct PointToPointState
+{
+    double ini_pos[JOINTS_PER_INSTRUMENT];
+    double final_pos[JOINTS_PER_INSTRUMENT];
+    double joint_acc[JOINTS_PER_INSTRUMENT];
+    double max_time;
+    double acc_time;
+    double cruise_time;
+    double t;
+};
+
+void InstrumentMotionPlanner::start_pt_to_pt(const double ini_pos[JOINTS_PER_INSTRUMENT], const double final_pos[JOINTS_PER_INSTRUMENT])
+{
+    double joint_vel[JOINTS_PER_INSTRUMENT] = {0.5, 0.5, 0.5, 0.5};
+    double joint_acc[JOINTS_PER_INSTRUMENT] = {0.5, 0.5, 0.5, 0.5};
 
-    double joint_vel[4] = {0.5, 0.5, 0.5, 0.5};
-    double joint_acc[4] = {0.5, 0.5, 0.5, 0.5};
+    std::copy_n(ini_pos, JOINTS_PER_INSTRUMENT, ptToPt.ini_pos);
+    std::copy_n(final_pos, JOINTS_PER_INSTRUMENT, ptToPt.final_pos);
 
     // taking care of vel and acceleration sign
-    for (int jnt_ctr = 0; jnt_ctr < num_joints; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < JOINTS_PER_INSTRUMENT; jnt_ctr++)
     {
 
         if (final_pos[jnt_ctr] < ini_pos[jnt_ctr])
@@ -24,12 +37,11 @@ int InstrumentMotionPlanner::pt_to_pt_mvmt(double ini_pos[NUM_JOINTS], double fi
     }
 
     // computing minimum time
-    double max_time, global_acc_time, global_cruise_time;
-    max_time = 0;
+    double max_time = 0, global_acc_time = 0, global_cruise_time = 0;
 
-    for (int jnt_ctr = 0; jnt_ctr < num_joints; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < JOINTS_PER_INSTRUMENT; jnt_ctr++)
     {
-        double acc_dist, cruise_dist;
+        double acc_dist;
 
         double acc_time, cruise_time, local_time;
 
@@ -73,95 +85,63 @@ int InstrumentMotionPlanner::pt_to_pt_mvmt(double ini_pos[NUM_JOINTS], double fi
         }
     }
 
-    // computing joint_vel and joint acc
-    for (unsigned int jnt_ctr = 0; jnt_ctr < num_joints; jnt_ctr++)
+    // computing joint_vel and joint acc, all joints arrive together
+    for (int jnt_ctr = 0; jnt_ctr < JOINTS_PER_INSTRUMENT; jnt_ctr++)
     {
         double joint_diff = final_pos[jnt_ctr] - ini_pos[jnt_ctr];
-        joint_acc[jnt_ctr] = joint_diff / (global_acc_time * global_acc_time + global_acc_time * global_cruise_time);
+        ptToPt.joint_acc[jnt_ctr] = max_time > 0 ? joint_diff / (global_acc_time * global_acc_time + global_acc_time * global_cruise_time) : 0;
     }
 
-    double t = 0;
-    double current_pos[4] = {0};
-    double current_vel[4] = {0};
-    double current_acc[4] = {0};
-
-    // std::cout << "max_time : " << max_time << std::endl;
+    ptToPt.max_time = max_time;
+    ptToPt.acc_time = global_acc_time;
+    ptToPt.cruise_time = global_cruise_time;
+    ptToPt.t = 0;
+}
 
-    while (t < max_time)
+// One cycle of the profile, returns false once the goal is reached
+bool InstrumentMotionPlanner::step_pt_to_pt()
+{
+    if (ptToPt.t >= ptToPt.max_time)
     {
-        /* int clock_gettime( clockid_t clock_id, struct
-     timespec *tp ); The clock_gettime() function gets
-     the current time of the clock specified by clock_id,
-     and puts it into the buffer  pointed to by tp.tp
-     parameter points to a structure containing
-     atleast the following members:
-     struct timespec {
-               time_t   tv_sec;        // seconds
-               long     tv_nsec;       // nanoseconds
-           };
-    clock id = CLOCK_REALTIME, CLOCK_PROCESS_CPUTIME_ID,
-               CLOCK_MONOTONIC ...etc
-    CLOCK_REALTIME : clock  that  measures real (i.e., wall-clock) time.
-    CLOCK_PROCESS_CPUTIME_ID : High-resolution per-process timer
-                               from the CPU.
-    CLOCK_MONOTONIC : High resolution timer that is unaffected
-                      by system date changes (e.g. NTP daemons).  */
-        struct timespec start, end;
-
-        clock_gettime(CLOCK_MONOTONIC, &start);
-
-        // unsync the I/O of C and C++.
-        ios_base::sync_with_stdio(false);
-
-        t = t + 0.002;
-
-        if ((fabs(t - max_time) < 1e-4) || t > max_time)
-        {
-            t = max_time;
-        }
+        return false;
+    }
 
-        // std::cout<<t<<",";
+    double &t = ptToPt.t;
+    double current_pos[JOINTS_PER_INSTRUMENT];
 
-        for (int jnt_ctr = 0; jnt_ctr < num_joints; jnt_ctr++)
-        {
+    // Advances with the cycle, not the wall clock
+    t = t + cycleTime;
 
-            if (t < global_acc_time)
-            {
-                current_acc[jnt_ctr] = joint_acc[jnt_ctr];
-                current_vel[jnt_ctr] = joint_acc[jnt_ctr] * t;
-                current_pos[jnt_ctr] = ini_pos[jnt_ctr] + 0.5 * joint_acc[jnt_ctr] * t * t;
-            }
-            else if (t < global_acc_time + global_cruise_time)
-            {
-                current_acc[jnt_ctr] = 0;
-                current_vel[jnt_ctr] = joint_acc[jnt_ctr] * global_acc_time;
-                current_pos[jnt_ctr] = ini_pos[jnt_ctr] + 0.5 * joint_acc[jnt_ctr] * global_acc_time * global_acc_time + current_vel[jnt_ctr] * (t - global_acc_time);
-            }
-            else if (t < 2 * global_acc_time + global_cruise_time)
-            {
-                current_acc[jnt_ctr] = -joint_acc[jnt_ctr];
-                current_vel[jnt_ctr] = joint_acc[jnt_ctr] * (max_time - t);
-                current_pos[jnt_ctr] = ini_pos[jnt_ctr] + final_pos[jnt_ctr] - ini_pos[jnt_ctr] - 0.5 * joint_acc[jnt_ctr] * (max_time - t) * (max_time - t);
-            }
-            else
-            {
-                current_acc[jnt_ctr] = 0;
-                current_vel[jnt_ctr] = 0;
-                current_pos[jnt_ctr] = final_pos[jnt_ctr];
-            }
-        }
-
-        clock_gettime(CLOCK_MONOTONIC, &end);
-
-        // Calculating total time taken by the program.
-        double time_taken;
-        time_taken = (end.tv_sec - start.tv_sec) * 1e9;
-        time_taken = (time_taken + (end.tv_nsec - start.tv_nsec)) * 1e-9;
+    if ((fabs(t - ptToPt.max_time) < 1e-4) || t > ptToPt.max_time)
+    {
+        t = ptToPt.max_time;
+    }
 
-        write_to_drive(current_pos);
+    for (int jnt_ctr = 0; jnt_ctr < JOINTS_PER_INSTRUMENT; jnt_ctr++)
+    {
+        double joint_acc = ptToPt.joint_acc[jnt_ctr];
+        double ini_pos = ptToPt.ini_pos[jnt_ctr];
+        double final_pos = ptToPt.final_pos[jnt_ctr];
 
-        usleep(2000);
+        if (t < ptToPt.acc_time)
+        {
+            current_pos[jnt_ctr] = ini_pos + 0.5 * joint_acc * t * t;
+        }
+        else if (t < ptToPt.acc_time + ptToPt.cruise_time)
+        {
+            current_pos[jnt_ctr] = ini_pos + 0.5 * joint_acc * ptToPt.acc_time * ptToPt.acc_time + joint_acc * ptToPt.acc_time * (t - ptToPt.acc_time);
+        }
+        else if (t < 2 * ptToPt.acc_time + ptToPt.cruise_time)
+        {
+            current_pos[jnt_ctr] = final_pos - 0.5 * joint_acc * (ptToPt.max_time - t) * (ptToPt.max_time - t);
+        }
+        else
+        {
+            current_pos[jnt_ctr] = final_pos;
+        }
     }
 
-    return 0;
-}
\ No newline at end of file
+    write_to_drive(current_pos);
+
+    return t < ptToPt.max_time;
+}
@@ -2,365 +2,148 @@
 
 #include "instrument_motion_planner.h"
 
-double InstrumentMotionPlanner::sterile_engagement()
+// Steps the joints one HOMING_SPEED step per cycle until each lags its command
+// by CONTACT_LAG. Returns within the cycle the last of them makes contact.
+Procedure InstrumentMotionPlanner::move_until_contact(Contact *contacts, int count)
 {
-
-    double ini_pos[NUM_JOINTS], final_pos[NUM_JOINTS];
-
-    for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
-    {
-        ini_pos[jnt_ctr] = appDataPtr->actual_position[jnt_ctr];
-        final_pos[jnt_ctr] = ini_pos[jnt_ctr] + (4 * M_PI + 0.02);
-    }
-
-    bool start_homing = true;
-    double sterile_time = 0;
-    double command_pos[NUM_JOINTS];
-    bool do_home[NUM_JOINTS] = {true, true, true, true};
-    std::copy(std::begin(appDataPtr->actual_position), std::end(appDataPtr->actual_position), std::begin(command_pos));
-
-    std::cout << "Outside start_homing : " << start_homing << ", !exitFlag : " << (!exitFlag) << std::endl;
-
-    bool home_jaws = false;
-    bool home_pitch = false;
-
-    bool outer_pitch1_identified = false;
-    // bool outer_pitch_2_identified = false;
-    double outer_pitch_1_pos;
-    double outer_pitch_2_pos;
-
-    bool outer_pos_jaw1_identified = false;
-    bool outer_pos_jaw2_identified = false;
-
-    bool inner_pos_jaw1_identified = false;
-    bool inner_pos_jaw2_identified = false;
-
-    bool jaw1_backlash_compute = false;
-    bool jaw2_backlash_compute = false;
-
-    double outer_pos_jaw1, outer_pos_jaw2, outer_pos_jaw1_ret, outer_pos_jaw2_ret;
-    double inner_pos_jaw1, inner_pos_jaw2;
-
-    double jaw1_backlash, jaw2_backlash;
-
-    bool jaw1_center, jaw2_center, pitch_center;
-
-    double center_dist = 0;
-
-    jaw1_center = false;
-    jaw2_center = false;
-    pitch_center = false;
-
-    bool opening_jaws_step = false;
-    bool backlash_jaw1_step = false;
-    bool backlash_jaw2_step = false;
-    bool centering_step = false;
-
-    bool inner_pos_pitch_identified = false;
-    bool outer_pos_pitch_identified = false;
-    double inner_pos_pitch = 0;
-    double outer_pos_pitch = 0;
-    double outer_pos_pitch_ret = 0;
-    double pitch_backlash = 0;
-    bool pitch_backlash_compute = false;
-
-    std::cout << "homing started \n";
-
-    while (start_homing && !exitFlag)
+    while (true)
     {
+        // Same speed whatever the cycle period
+        double step = HOMING_SPEED * cycleTime;
+        int found = 0;
 
-        sterile_time = sterile_time + 0.001;
-
-        int homing_ctr = 0;
-
-        if (home_jaws == false)
+        for (int contact_ctr = 0; contact_ctr < count; contact_ctr++)
         {
-
-            // Opening the jaws here
-            if (opening_jaws_step == false)
+            Contact &contact = contacts[contact_ctr];
+            if (!contact.found)
             {
+                int joint = contact.joint;
+                procedureCommand[joint] = procedureCommand[joint] + contact.dir * step;
 
-                if (outer_pos_jaw1_identified == false)
+                if (fabs(procedureCommand[joint] - appDataPtr->actual_position[joint]) > CONTACT_LAG)
                 {
-                    command_pos[1] = command_pos[1] + 0.001;
-
-                    if ((fabs(command_pos[1] - appDataPtr->actual_position[1]) > 0.05))
+                    contact.position = appDataPtr->actual_position[joint];
+                    contact.found = true;
+                    if (contact.hold)
                     {
-                        outer_pos_jaw1 = appDataPtr->actual_position[1];
-                        outer_pos_jaw1_identified = true;
-                        command_pos[1] = appDataPtr->actual_position[1];
-                    }
-                }
-
-                if (outer_pos_jaw2_identified == false)
-                {
-                    command_pos[2] = command_pos[2] - 0.001;
-
-                    if ((fabs(command_pos[2] - appDataPtr->actual_position[2]) > 0.05))
-                    {
-                        outer_pos_jaw2 = appDataPtr->actual_position[2];
-                        outer_pos_jaw2_identified = true;
-                        command_pos[2] = appDataPtr->actual_position[2];
+                        procedureCommand[joint] = appDataPtr->actual_position[joint];
                     }
                 }
             }
+            found += contact.found;
+        }
 
-            // Computing the backlash here
-
-            if (outer_pos_jaw1_identified == true && outer_pos_jaw2_identified == true)
-            {
-
-                if (backlash_jaw1_step == false)
-                {
-
-                    if (jaw1_backlash_compute == false)
-                    {
-
-                        if (inner_pos_jaw1_identified == false)
-                        {
-                            command_pos[1] = command_pos[1] - 0.001;
-
-                            if ((fabs(command_pos[1] - appDataPtr->actual_position[1]) > 0.05))
-                            {
-                                inner_pos_jaw1 = appDataPtr->actual_position[1];
-                                inner_pos_jaw1_identified = true;
-                            }
-                        }
-                        else
-                        {
-
-                            command_pos[1] = command_pos[1] + 0.001;
-
-                            if ((fabs(command_pos[1] - appDataPtr->actual_position[1]) > 0.05))
-                            {
-                                outer_pos_jaw1_ret = appDataPtr->actual_position[1];
-                                jaw1_backlash_compute = true;
-                                jaw1_backlash = (outer_pos_jaw1 + outer_pos_jaw1_ret) / 2 - inner_pos_jaw1 - (outer_pos_jaw1) / fabs(outer_pos_jaw1) * (33.5 / 180 * 22 / 7);
-                                backlash_jaw1_step = true;
-                            }
-                        }
-                    }
-                }
-
-                if (backlash_jaw1_step == true && backlash_jaw2_step == false)
-                {
-
-                    if (jaw2_backlash_compute == false)
-                    {
+        if (found == count)
+        {
+            co_return;
+        }
+        co_await next_cycle();
+    }
+}
 
-                        if (inner_pos_jaw2_identified == false)
-                        {
-                            command_pos[2] = command_pos[2] + 0.001;
+Procedure InstrumentMotionPlanner::hold(double seconds)
+{
+    co_await until(TimeReached{procedureTime, procedureTime + seconds});
+}
 
-                            if ((fabs(command_pos[2] - appDataPtr->actual_position[2]) > 0.05))
-                            {
-                                inner_pos_jaw2 = appDataPtr->actual_position[2];
-                                inner_pos_jaw2_identified = true;
-                            }
-                        }
-                        else
-                        {
+// Finds the stops of both jaws and then of the pitch against the sterile
+// adapter, measures their backlash and leaves each joint centred between them
+Procedure InstrumentMotionPlanner::sterile_engagement()
+{
+    rtLog.info("homing started");
 
-                            command_pos[2] = command_pos[2] - 0.001;
+    // Opening the jaws here
+    Contact jaws_outer[2] = {{1, +1}, {2, -1}};
+    co_await move_until_contact(jaws_outer, 2);
 
-                            if ((fabs(command_pos[2] - appDataPtr->actual_position[2]) > 0.05))
-                            {
-                                outer_pos_jaw2_ret = appDataPtr->actual_position[2];
-                                jaw2_backlash_compute = true;
-                                jaw2_backlash = (outer_pos_jaw2 + outer_pos_jaw2_ret) / 2 - inner_pos_jaw2 - (outer_pos_jaw2) / fabs(outer_pos_jaw2) * (33.5 / 180 * 22 / 7);
-                                backlash_jaw2_step = true;
-                            }
-                        }
-                    }
-                }
-            }
+    // Computing the backlash here, in to the inner stop and from the next cycle back out
+    Contact jaw1_inner = {1, -1, false};
+    co_await move_until_contact(jaw1_inner);
+    co_await next_cycle();
+    Contact jaw1_outer_ret = {1, +1, false};
+    co_await move_until_contact(jaw1_outer_ret);
 
-            // Making it center
+    double outer_pos_jaw1 = jaws_outer[0].position;
+    double jaw1_backlash = (outer_pos_jaw1 + jaw1_outer_ret.position) / 2 - jaw1_inner.position - (outer_pos_jaw1) / fabs(outer_pos_jaw1) * (33.5 / 180 * 22 / 7);
 
-            if (jaw1_backlash_compute == true && jaw2_backlash_compute == true)
-            {
+    Contact jaw2_inner = {2, +1, false};
+    co_await move_until_contact(jaw2_inner);
+    co_await next_cycle();
+    Contact jaw2_outer_ret = {2, -1, false};
+    co_await move_until_contact(jaw2_outer_ret);
 
-                if (jaw1_center == false && (command_pos[1] > ((outer_pos_jaw1 + outer_pos_jaw1_ret) / 2 - jaw1_backlash)))
-                {
-                    command_pos[1] = command_pos[1] - 0.001;
-                }
-                else
-                {
-                    jaw1_center = true;
-                }
+    double outer_pos_jaw2 = jaws_outer[1].position;
+    double jaw2_backlash = (outer_pos_jaw2 + jaw2_outer_ret.position) / 2 - jaw2_inner.position - (outer_pos_jaw2) / fabs(outer_pos_jaw2) * (33.5 / 180 * 22 / 7);
 
-                if (jaw2_center == false && (command_pos[2] < ((outer_pos_jaw2 + outer_pos_jaw2_ret) / 2 - jaw2_backlash)))
-                {
-                    command_pos[2] = command_pos[2] + 0.001;
-                }
-                else
-                {
-                    jaw2_center = true;
-                }
+    // Making it center
+    double jaw1_center_pos = (outer_pos_jaw1 + jaw1_outer_ret.position) / 2 - jaw1_backlash;
+    double jaw2_center_pos = (outer_pos_jaw2 + jaw2_outer_ret.position) / 2 - jaw2_backlash;
+    bool jaw1_center = false, jaw2_center = false;
 
-                if (jaw1_center == true && jaw2_center == true)
-                {
+    while (true)
+    {
+        double step = HOMING_SPEED * cycleTime;
 
-                    if (center_dist < (33.5 / 180 * 22 / 7) / 2)
-                    {
-                        command_pos[1] = command_pos[1] - 0.001;
-                        command_pos[2] = command_pos[2] + 0.001;
-                        center_dist = center_dist + 0.001;
-                    }
-                    else
-                    {
-                        command_pos[1] = appDataPtr->actual_position[1];
-                        command_pos[2] = appDataPtr->actual_position[2];
-                        home_jaws = true;
-                        command_pos[0] = appDataPtr->actual_position[0];
-                        std::cout<<" jaws engaged : Command pos[0] : "<<command_pos[0]<<", appDataPtr->actual_position[0] : "<<appDataPtr->actual_position[0]<<std::endl;
-                        center_dist = 0;
-                    }
-                }
-            }
+        if (jaw1_center == false && procedureCommand[1] > jaw1_center_pos)
+        {
+            procedureCommand[1] = procedureCommand[1] - step;
         }
-        else if (home_pitch == false)
+        else
         {
+            jaw1_center = true;
+        }
 
-            if (outer_pos_pitch_identified == false)
-            {
-
-                command_pos[0] = command_pos[0] + 0.001;
-
-                if ((fabs(command_pos[0]) - appDataPtr->actual_position[0]) > 0.05)
-                {
-                    // std::cout << "pitch_part_engaged" << std::endl;
-                    outer_pos_pitch = appDataPtr->actual_position[0];
-                    command_pos[0] = appDataPtr->actual_position[0];
-                    outer_pos_pitch_identified = true;
-                    // std::cout << "outer_pos_pitch : " << outer_pos_pitch << std::endl;
-                }
-            }
-
-            if (outer_pos_pitch_identified)
-            {
-
-                if (pitch_backlash_compute == false)
-                {
-                    if (inner_pos_pitch_identified == false)
-                    {
-                        // std::cout<<"inner_pos_pitch_identified "<<std::endl;
-                        command_pos[0] = command_pos[0] - 0.001;
-
-                        if ((fabs(command_pos[0]) - appDataPtr->actual_position[0]) > 0.05)
-                        {
-                            inner_pos_pitch = appDataPtr->actual_position[0];
-                            command_pos[0] = appDataPtr->actual_position[0];
-                            inner_pos_pitch_identified = true;
-                            // std::cout << "inner_pos_pitch : " << inner_pos_pitch << std::endl;
-                        }
-                    }
-                    else
-                    {
-                        command_pos[0] = command_pos[0] + 0.001;
-
-                        // std::cout<<"inner_pos_pitch_identified true, command_pos[0]:  "<<command_pos[0]<<", appDataPtr->actual_position[0] : "<<appDataPtr->actual_position[0]<<std::endl;
-
-                        if ((fabs(command_pos[0]) - appDataPtr->actual_position[0]) > 0.05)
-                        {
-                            outer_pos_pitch_ret = appDataPtr->actual_position[0];
-                            command_pos[0] = appDataPtr->actual_position[0];
-                            pitch_backlash_compute = true;
-                            pitch_backlash = (outer_pos_pitch + outer_pos_pitch_ret) / 2 - inner_pos_pitch - (outer_pos_pitch) / fabs(outer_pos_pitch) * (7.0 / 180.0 * 22.0 / 7.0);
-                            // std::cout << ", outer_pos_pitch : " << outer_pos_pitch << ", outer_pos_pitch_ret : " << outer_pos_pitch_ret << ", inner_pos_pitch : " << inner_pos_pitch << ", Comp term : " << (outer_pos_pitch) / fabs(outer_pos_pitch) * (7.0 / 180.0 * 22.0 / 7.0) << std::endl;
-
-                            // std::cout << "pitch_backlash : " << pitch_backlash << std::endl;
-                        }
-                    }
-                }
-            }
-
-            if (pitch_backlash_compute == true)
-            {
-                // std::cout << "Making pitch part straight, pitch_backlash: " << pitch_backlash << std::endl;
-
-                // std::cout << "command_pos[0] : " << command_pos[0] << ", outer_pos_pitch : " << outer_pos_pitch << ", outer_pos_pitch_ret : " << outer_pos_pitch_ret << std::endl;
-
-                // std::cout << "command_pos[0] : " << command_pos[0] << ", outer_pos_pitch : " << (outer_pos_pitch + outer_pos_pitch_ret) / 2 << ", pitch_backlash : " << pitch_backlash << std::endl;
-
-                // std::cout<<"(command_pos[0] > ((outer_pos_pitch + outer_pos_pitch_ret) / 2 - pitch_backlash))"
-
-                if (pitch_center == false && (command_pos[0] > ((outer_pos_pitch + outer_pos_pitch_ret) / 2 - pitch_backlash)))
-                {
-                    command_pos[0] = command_pos[0] - 0.001;
-                }
-                else
-                {
-                    pitch_center = true;
-                    // std::cout << "command_pos[0] : " << command_pos[0] << ", outer_pos_pitch : " << (outer_pos_pitch + outer_pos_pitch_ret) / 2 << ", pitch_backlash : " << pitch_backlash << std::endl;
-                }
-
-                if (pitch_center == true)
-                {
-
-                    if (center_dist < (7 / 180 * 22 / 7) / 2)
-                    {
-                        command_pos[0] = command_pos[0] - 0.001;
-                        center_dist = center_dist + 0.001;
-                    }
-                    else
-                    {
-                        command_pos[0] = appDataPtr->actual_position[0];
-                        home_pitch = true;
-                        start_homing = false;
-
-                        std::cout<<"home_pitch : "<<std::endl;
-                    }
-                }
-            }
+        if (jaw2_center == false && procedureCommand[2] < jaw2_center_pos)
+        {
+            procedureCommand[2] = procedureCommand[2] + step;
         }
         else
         {
-            std::cout<<"homing over"<<std::endl;
+            jaw2_center = true;
         }
 
-        // for (int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
-        // {
-
-        //     if
-
-        //     // // std::cout<<"do_home["<<jnt_ctr<<"]"<<do_home[jnt_ctr]<<std::endl;
-
-        //     // if (do_home[jnt_ctr])
-        //     // {
-        //     //     command_pos[jnt_ctr] = command_pos[jnt_ctr] + 0.001;
-
-        //     //     if ((fabs(command_pos[jnt_ctr] - appDataPtr->actual_position[jnt_ctr]) > 0.5 && (fabs(appDataPtr->actual_torque[jnt_ctr]) > 1.0)))
-        //     //     {
-        //     //         std::cout << "fabs(command_pos[jnt_ctr] - appDataPtr->actual_position[jnt_ctr]) > 0.5 : " << (fabs(command_pos[jnt_ctr] - appDataPtr->actual_position[jnt_ctr]) > 0.5) << std::endl;
-        //     //         std::cout << "(fabs(appDataPtr->actual_torque[jnt_ctr]) > 1.0 ) : " << (fabs(appDataPtr->actual_torque[jnt_ctr]) > 1.0) << std::endl;
-        //     //         std::cout << "(command_pos[jnt_ctr] > final_pos[jnt_ctr]) : " << (command_pos[jnt_ctr] > final_pos[jnt_ctr]) << std::endl;
-
-        //     //         do_home[jnt_ctr] = false;
-        //     //     }
-        //     // }
-        //     // else
-        //     // {
-        //     //     command_pos[jnt_ctr] = appDataPtr->actual_position[jnt_ctr];
-        //     //     homing_ctr++;
-        //     // }
-
-        //     // std::cout<<"do_home["<<jnt_ctr<<"]"<<do_home[jnt_ctr]<<", command_pos: "<<command_pos[jnt_ctr]<<", actual_pos : "<<appDataPtr->actual_position[jnt_ctr]<<"actual torq : "<<appDataPtr->actual_torque[jnt_ctr]<<std::endl;
-        // }
-
-        // if (homing_ctr == NUM_JOINTS)
-        // {
-        //     start_homing = false;
-        // }
-
-        write_to_drive(command_pos);
-
-        // std::cout<<"start_homing : "<<start_homing<<", !exitFlag : "<<(!exitFlag)<<", homing_ctr : "<<homing_ctr<<std::endl;
+        if (jaw1_center && jaw2_center)
+        {
+            break;
+        }
+        co_await next_cycle();
+    }
 
-        usleep(1000);
+    double center_dist = 0;
+    while (center_dist < (33.5 / 180 * 22 / 7) / 2)
+    {
+        double step = HOMING_SPEED * cycleTime;
+        procedureCommand[1] = procedureCommand[1] - step;
+        procedureCommand[2] = procedureCommand[2] + step;
+        center_dist = center_dist + step;
+        co_await next_cycle();
     }
 
-    commandDataPtr->type = CommandType::NONE;
+    procedureCommand[1] = appDataPtr->actual_position[1];
+    procedureCommand[2] = appDataPtr->actual_position[2];
+    procedureCommand[0] = appDataPtr->actual_position[0];
+    rtLog.info("jaws engaged : Command pos[0] : %f, appDataPtr->actual_position[0] : %f", procedureCommand[0], appDataPtr->actual_position[0]);
+    co_await next_cycle();
+
+    // Same for the pitch
+    Contact pitch_outer = {0, +1};
+    co_await move_until_contact(pitch_outer);
+    Contact pitch_inner = {0, -1};
+    co_await move_until_contact(pitch_inner);
+    co_await next_cycle();
+    Contact pitch_outer_ret = {0, +1};
+    co_await move_until_contact(pitch_outer_ret);
+
+    double outer_pos_pitch = pitch_outer.position;
+    double pitch_backlash = (outer_pos_pitch + pitch_outer_ret.position) / 2 - pitch_inner.position - (outer_pos_pitch) / fabs(outer_pos_pitch) * (7.0 / 180.0 * 22.0 / 7.0);
+    double pitch_center_pos = (outer_pos_pitch + pitch_outer_ret.position) / 2 - pitch_backlash;
+
+    while (procedureCommand[0] > pitch_center_pos)
+    {
+        procedureCommand[0] = procedureCommand[0] - HOMING_SPEED * cycleTime;
+        co_await next_cycle();
+    }
 
-    return 0;
-}
\ No newline at end of file
+    procedureCommand[0] = appDataPtr->actual_position[0];
+    rtLog.info("home_pitch");
+}
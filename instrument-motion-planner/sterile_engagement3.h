@@ -2,185 +2,54 @@
 
 #include "instrument_motion_planner.h"
 
-double InstrumentMotionPlanner::sterile_engagement()
+// Moves along direction from ini_pos out to +movement, across to -movement and
+// back to ini_pos, each movement taking time seconds
+Procedure InstrumentMotionPlanner::sweep(const double ini_pos[JOINTS_PER_INSTRUMENT], const double direction[JOINTS_PER_INSTRUMENT], double movement, double time)
 {
+    const double starts[3] = {0, movement, -movement};
+    const double ends[3] = {movement, -movement, 0};
 
-    double ini_pos[NUM_JOINTS], final_pos[NUM_JOINTS];
-
-    for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int leg_ctr = 0; leg_ctr < 3; leg_ctr++)
     {
-        ini_pos[jnt_ctr] = appDataPtr->actual_position[jnt_ctr];
-        final_pos[jnt_ctr] = ini_pos[jnt_ctr] + (4 * M_PI + 0.02);
-    }
-
-    bool start_homing = true;
-    double sterile_time = 0;
-    double command_pos[NUM_JOINTS];
-    bool do_home[NUM_JOINTS] = {true, true, true, true};
-    std::copy(std::begin(appDataPtr->actual_position), std::end(appDataPtr->actual_position), std::begin(command_pos));
-
-    std::cout<<"Outside start_homing : "<<start_homing<<", !exitFlag : "<<(!exitFlag)<<std::endl;
-
-    while (start_homing && !exitFlag){
-
-        double total_movement = M_PI/3;
-        double total_time = 300;
-        double time = 0;
-
-        // pitch movement
-
-        while (time < total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0] + total_movement/total_time*time;
-            final_pos[1] = ini_pos[1] - 0.7 * total_movement/total_time*time;
-            final_pos[2] = ini_pos[2] - 0.7 * total_movement/total_time*time;
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
+        double leg_time = time * fabs(ends[leg_ctr] - starts[leg_ctr]) / movement;
+        double t = 0;
+
+        while (t < leg_time)
+        {
+            t = t + cycleTime;
+            double amount = starts[leg_ctr] + (ends[leg_ctr] - starts[leg_ctr]) / leg_time * t;
+            for (int jnt_ctr = 0; jnt_ctr < JOINTS_PER_INSTRUMENT; jnt_ctr++)
+            {
+                procedureCommand[jnt_ctr] = ini_pos[jnt_ctr] + direction[jnt_ctr] * amount;
+            }
+            co_await next_cycle();
         }
+    }
+}
 
-        time = 0;
-        while (time < 2*total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0] + (total_movement - total_movement/total_time*time);
-            final_pos[1] = ini_pos[1] - 0.7 * (total_movement - total_movement/total_time*time);
-            final_pos[2] = ini_pos[2] - 0.7 * (total_movement - total_movement/total_time*time);
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-
-        time = 0;
-        while (time < total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0] + (-total_movement + total_movement/total_time*time);
-            final_pos[1] = ini_pos[1] - 0.7 * (-total_movement + total_movement/total_time*time);
-            final_pos[2] = ini_pos[2] - 0.7 * (-total_movement + total_movement/total_time*time);
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-
-        usleep(100000);
-
-        // yaw movement
-
-        time = 0;
-        while (time < total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1] + total_movement/total_time*time;
-            final_pos[2] = ini_pos[2] + total_movement/total_time*time;
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-
-        time = 0;
-        while (time < 2*total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1] + (total_movement - total_movement/total_time*time);
-            final_pos[2] = ini_pos[2] + (total_movement - total_movement/total_time*time);
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-
-        time = 0;
-        while (time < total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1] + (-total_movement + total_movement/total_time*time);
-            final_pos[2] = ini_pos[2] + (-total_movement + total_movement/total_time*time);
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-
-        usleep(100000);
-
-        // pinch movement
-
-        time = 0;
-
-        while (time < total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1] + total_movement/total_time*time;
-            final_pos[2] = ini_pos[2] - total_movement/total_time*time;
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-
-        time = 0;
-        while (time < 2*total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1] + (total_movement - total_movement/total_time*time);
-            final_pos[2] = ini_pos[2] - (total_movement - total_movement/total_time*time);
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-
-        time = 0;
-        while (time < total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1] + (-total_movement + total_movement/total_time*time);
-            final_pos[2] = ini_pos[2] - (-total_movement + total_movement/total_time*time);
-            final_pos[3] = ini_pos[3];
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-
-        usleep(100000);
-
-        // roll movement
-
-        time = 0;
-
-        while (time < total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1];
-            final_pos[2] = ini_pos[2];
-            final_pos[3] = ini_pos[3] + 3*total_movement/total_time*time;
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
+// Pitch, yaw, pinch and roll back and forth around the start position, until aborted
+Procedure InstrumentMotionPlanner::scripted_motions()
+{
+    constexpr double total_movement = M_PI / 3;
+    constexpr double total_time = 0.3; // seconds
 
-        time = 0;
-        while (time < 2*total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1];
-            final_pos[2] = ini_pos[2];
-            final_pos[3] = ini_pos[3] + 3*(total_movement - total_movement/total_time*time);
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
+    const double pitch[JOINTS_PER_INSTRUMENT] = {1, -0.7, -0.7, 0};
+    const double yaw[JOINTS_PER_INSTRUMENT] = {0, 1, 1, 0};
+    const double pinch[JOINTS_PER_INSTRUMENT] = {0, 1, -1, 0};
+    const double roll[JOINTS_PER_INSTRUMENT] = {0, 0, 0, 3};
 
-        time = 0;
-        while (time < total_time){
-            time = time + 1;
-            final_pos[0] = ini_pos[0];
-            final_pos[1] = ini_pos[1];
-            final_pos[2] = ini_pos[2];
-            final_pos[3] = ini_pos[3] + 3*(-total_movement + total_movement/total_time*time);
-            write_to_drive(final_pos);
-            usleep(1000);
-        }
-        
-        usleep(1000);
+    double ini_pos[JOINTS_PER_INSTRUMENT];
+    std::copy_n(appDataPtr->actual_position, JOINTS_PER_INSTRUMENT, ini_pos);
 
+    while (true)
+    {
+        co_await sweep(ini_pos, pitch, total_movement, total_time);
+        co_await hold(0.1);
+        co_await sweep(ini_pos, yaw, total_movement, total_time);
+        co_await hold(0.1);
+        co_await sweep(ini_pos, pinch, total_movement, total_time);
+        co_await hold(0.1);
+        co_await sweep(ini_pos, roll, total_movement, total_time);
+        co_await next_cycle();
     }
-
-    
-
-    commandDataPtr->type = CommandType::NONE;
-
-    return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <csignal>
+
+// Set on SIGINT, every RT loop of the process stops on it. One flag per
+// process, so one signal stops all components instrument_rt hosts.
+inline volatile sig_atomic_t exitFlag = 0;
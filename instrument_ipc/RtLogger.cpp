@@ -0,0 +1,136 @@
+#include "RtLogger.h"
+#include <pthread.h>
+#include <sched.h>
+
+static const char *levelName(RtLogLevel level)
+{
+    switch (level)
+    {
+    case RtLogLevel::WARN:
+        return "WARN";
+    case RtLogLevel::ERROR:
+        return "ERROR";
+    default:
+        return "INFO";
+    }
+}
+
+RtLogger::~RtLogger()
+{
+    stop();
+}
+
+void RtLogger::start(const char *name)
+{
+    if (running.load())
+    {
+        return;
+    }
+    processName = name;
+    running.store(true);
+    thread = std::thread(&RtLogger::run, this);
+}
+
+void RtLogger::stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+    thread.join();
+
+    uint64_t lost = dropped.load(std::memory_order_relaxed);
+    if (lost != 0)
+    {
+        printf("[%s] %lu log records dropped, the log ring was full\n", processName, (unsigned long)lost);
+    }
+}
+
+// Called on the RT thread only, so the table needs no synchronisation
+bool RtLogger::admit(uint64_t key, uint32_t &suppressed)
+{
+    int64_t now = monotonic_ns();
+    size_t slot = key % RT_LOG_RATE_LIMIT_SLOTS;
+    RateLimit *oldest = &rateLimits[slot];
+
+    for (int probe = 0; probe < RT_LOG_RATE_LIMIT_SLOTS; probe++)
+    {
+        RateLimit &limit = rateLimits[(slot + probe) % RT_LOG_RATE_LIMIT_SLOTS];
+        if (!limit.used)
+        {
+            oldest = &limit;
+            break;
+        }
+        if (limit.key == key)
+        {
+            if (now - limit.last_ns < RT_LOG_REPEAT_INTERVAL_NS)
+            {
+                limit.suppressed++;
+                return false;
+            }
+            suppressed = limit.suppressed;
+            limit.last_ns = now;
+            limit.suppressed = 0;
+            return true;
+        }
+        if (limit.last_ns < oldest->last_ns)
+        {
+            oldest = &limit;
+        }
+    }
+
+    // New key, takes a free slot or the one logged longest ago
+    oldest->used = true;
+    oldest->key = key;
+    oldest->last_ns = now;
+    oldest->suppressed = 0;
+    suppressed = 0;
+    return true;
+}
+
+void RtLogger::run()
+{
+    // Never compete with the RT loop, whatever the creating thread was running at
+    struct sched_param param = {};
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+    while (running.load(std::memory_order_relaxed))
+    {
+        if (!drain())
+        {
+            usleep(RT_LOG_POLL_US);
+        }
+    }
+    drain();
+}
+
+// Formats everything published so far, false if there was nothing
+bool RtLogger::drain()
+{
+    uint32_t index = tail.load(std::memory_order_relaxed);
+    uint32_t end = head.load(std::memory_order_acquire);
+    if (index == end)
+    {
+        return false;
+    }
+
+    char message[256];
+    for (; index != end; index++)
+    {
+        const Record &record = records[index & (RT_LOG_CAPACITY - 1)];
+        record.formatter(message, sizeof(message), record.format, record.args);
+
+        if (record.suppressed != 0)
+        {
+            printf("[%s %.6f] %s %s (%u repeats suppressed)\n", processName, record.timestamp_ns * 1e-9,
+                   levelName(record.level), message, record.suppressed);
+        }
+        else
+        {
+            printf("[%s %.6f] %s %s\n", processName, record.timestamp_ns * 1e-9, levelName(record.level), message);
+        }
+        tail.store(index + 1, std::memory_order_release);
+    }
+    fflush(stdout);
+    return true;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include "SharedObject.h"
+
+// Logging from the RT loops without touching the terminal. The RT thread copies
+// the format pointer and its arguments into a fixed-size record of a
+// single-producer/single-consumer ring, a normal priority thread formats the
+// records and writes them to stdout. Formats must be string literals and
+// arguments numbers or pointers to static strings, they are formatted later.
+// A full ring drops the record and counts it instead of blocking.
+//
+// The same format with the same integer and pointer arguments (joint, error
+// code, state name, ...) is logged at most once per RT_LOG_REPEAT_INTERVAL_NS,
+// floating point arguments are measurements and do not tell repeats apart. The
+// next record that gets through reports how many were suppressed meanwhile.
+// ERROR records are never suppressed.
+constexpr uint32_t RT_LOG_CAPACITY = 1024; // records, must be a power of two
+constexpr size_t RT_LOG_ARG_BYTES = 64;
+constexpr int64_t RT_LOG_REPEAT_INTERVAL_NS = 1000000000;
+constexpr int RT_LOG_RATE_LIMIT_SLOTS = 64;
+constexpr useconds_t RT_LOG_POLL_US = 10000;
+
+enum class RtLogLevel : uint8_t
+{
+    INFO,
+    WARN,
+    ERROR,
+};
+
+class RtLogger
+{
+public:
+    ~RtLogger();
+
+    // Starts the formatting thread, call before the process switches to SCHED_FIFO
+    void start(const char *name);
+    // Drains the ring and joins the formatting thread
+    void stop();
+
+    template <typename... Args>
+    void info(const char *format, Args... args) { log(RtLogLevel::INFO, format, args...); }
+    template <typename... Args>
+    void warn(const char *format, Args... args) { log(RtLogLevel::WARN, format, args...); }
+    template <typename... Args>
+    void error(const char *format, Args... args) { log(RtLogLevel::ERROR, format, args...); }
+
+    template <typename... Args>
+    void log(RtLogLevel level, const char *format, Args... args)
+    {
+        static_assert(((std::is_arithmetic<Args>::value || std::is_pointer<Args>::value) && ...),
+                      "RtLogger only takes numbers and pointers to static strings");
+        static_assert(sizeof(std::tuple<Args...>) <= RT_LOG_ARG_BYTES, "too many RtLogger arguments");
+
+        uint32_t suppressed = 0;
+        if (level != RtLogLevel::ERROR && !admit(repeatKey(format, args...), suppressed))
+        {
+            return;
+        }
+
+        uint32_t index = head.load(std::memory_order_relaxed);
+        if (index - tail.load(std::memory_order_acquire) == RT_LOG_CAPACITY)
+        {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        Record &record = records[index & (RT_LOG_CAPACITY - 1)];
+        record.timestamp_ns = monotonic_ns();
+        record.format = format;
+        record.formatter = &formatArgs<Args...>;
+        record.level = level;
+        record.suppressed = suppressed;
+        new (record.args) std::tuple<Args...>(args...);
+        head.store(index + 1, std::memory_order_release);
+    }
+
+private:
+    typedef int (*Formatter)(char *buffer, size_t size, const char *format, const void *args);
+
+    struct alignas(CACHE_LINE_SIZE) Record
+    {
+        int64_t timestamp_ns;
+        const char *format;
+        Formatter formatter;
+        RtLogLevel level;
+        uint32_t suppressed; // repeats of this format dropped before this record
+        alignas(8) unsigned char args[RT_LOG_ARG_BYTES];
+    };
+
+    struct RateLimit
+    {
+        bool used = false;
+        uint64_t key = 0;
+        int64_t last_ns = 0;
+        uint32_t suppressed = 0;
+    };
+
+    // FNV-1a over the format pointer and the arguments that identify a repeat
+    template <typename... Args>
+    static uint64_t repeatKey(const char *format, Args... args)
+    {
+        uint64_t key = (0xcbf29ce484222325ULL ^ reinterpret_cast<uintptr_t>(format)) * 0x100000001b3ULL;
+        ((key = foldRepeatKey(key, args)), ...);
+        return key;
+    }
+
+    template <typename T>
+    static uint64_t foldRepeatKey(uint64_t key, T value)
+    {
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            return key;
+        }
+        else if constexpr (std::is_pointer<T>::value)
+        {
+            return (key ^ reinterpret_cast<uintptr_t>(value)) * 0x100000001b3ULL;
+        }
+        else
+        {
+            return (key ^ static_cast<uint64_t>(value)) * 0x100000001b3ULL;
+        }
+    }
+
+    template <typename... Args>
+    static int formatArgs(char *buffer, size_t size, const char *format, const void *args)
+    {
+        if constexpr (sizeof...(Args) == 0)
+        {
+            return snprintf(buffer, size, "%s", format);
+        }
+        else
+        {
+            const std::tuple<Args...> &values = *static_cast<const std::tuple<Args...> *>(args);
+            return std::apply([&](Args... unpacked)
+                              { return snprintf(buffer, size, format, unpacked...); },
+                              values);
+        }
+    }
+
+    bool admit(uint64_t key, uint32_t &suppressed);
+    void run();
+    bool drain();
+
+    const char *processName = "";
+    std::thread thread;
+    std::atomic<bool> running{false};
+
+    // Producer (RT thread) state
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> head{0};
+    std::atomic<uint64_t> dropped{0};
+    RateLimit rateLimits[RT_LOG_RATE_LIMIT_SLOTS];
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail{0}; // consumer (formatting thread)
+    Record records[RT_LOG_CAPACITY];
+};
@@ -0,0 +1,386 @@
+#include "SharedMemory.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+// How long an attaching process waits for a concurrent creator to size the
+// segment and publish its header
+constexpr int ATTACH_RETRIES = 100;
+constexpr useconds_t ATTACH_RETRY_US = 10000;
+
+// Every segment this process has mapped, by payload address. Hugepage mappings
+// have to be unmapped with their rounded-up length. Opening a segment that is
+// already mapped returns the same payload, so components hosted in one process
+// (instrument_rt) share one mapping and hand data over by reference.
+struct SegmentMapping
+{
+    std::string name;
+    size_t size;   // payload
+    size_t length; // mapped
+    int users;
+};
+static std::map<void *, SegmentMapping> mappings;
+static std::mutex mappingsLock;
+
+static size_t roundUp(size_t size, size_t page_size)
+{
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+static off_t segmentSize(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        return 0;
+    }
+    return st.st_size;
+}
+
+// Returns true if the segment carries a published header, false for segments
+// left behind by a crashed creator or by a build from before the header existed
+static bool waitForHeader(int fd, size_t page_size, SegmentHeader &header)
+{
+    for (int retry = 0; retry < ATTACH_RETRIES; retry++)
+    {
+        if (segmentSize(fd) >= (off_t)sizeof(SegmentHeader))
+        {
+            void *ptr = mmap(0, page_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED)
+            {
+                return false;
+            }
+
+            SegmentHeader *mapped = static_cast<SegmentHeader *>(ptr);
+            bool published = mapped->magic.load(std::memory_order_acquire) == IPC_SEGMENT_MAGIC;
+            if (published)
+            {
+                header.version = mapped->version;
+                header.size = mapped->size;
+                header.max_joints = mapped->max_joints;
+            }
+            munmap(ptr, page_size);
+
+            if (published)
+            {
+                return true;
+            }
+        }
+        usleep(ATTACH_RETRY_US);
+    }
+    return false;
+}
+
+// Opens the segment in /dev/shm, or as a file under hugepage_dir if that is
+// given. Returns nullptr if the hugepage backing is unusable so the caller can
+// fall back to 4K pages; schema mismatches and /dev/shm failures throw.
+static void *openSegment(const char *name, size_t size, const char *hugepage_dir, size_t &mapped_length)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    std::string path;
+    if (hugepage_dir != nullptr)
+    {
+        struct statfs fs;
+        if (statfs(hugepage_dir, &fs) == -1 || fs.f_type != HUGETLBFS_MAGIC)
+        {
+            return nullptr;
+        }
+        page_size = fs.f_bsize;
+        path = std::string(hugepage_dir) + "/" + name;
+    }
+
+    size_t payload_offset = sizeof(SegmentHeader);
+    size_t map_size = roundUp(payload_offset + size, page_size);
+
+    auto openFd = [&](int flags)
+    {
+        return hugepage_dir != nullptr ? open(path.c_str(), flags, 0666) : shm_open(name, flags, 0666);
+    };
+
+    bool created = true;
+    int fd = openFd(O_CREAT | O_EXCL | O_RDWR);
+    if (fd == -1 && errno == EEXIST)
+    {
+        created = false;
+        fd = openFd(O_RDWR);
+    }
+    if (fd == -1)
+    {
+        if (hugepage_dir != nullptr)
+        {
+            return nullptr;
+        }
+        throw std::runtime_error(std::string("Failed to create shared memory object ") + name + ".");
+    }
+
+    // Undo a hugepage segment we created but could not back
+    auto abandon = [&]()
+    {
+        close(fd);
+        if (created)
+        {
+            unlink(path.c_str());
+        }
+        return nullptr;
+    };
+
+    SegmentHeader existing;
+    bool initialize = created || !waitForHeader(fd, page_size, existing);
+
+    if (!initialize)
+    {
+        if (existing.version != IPC_SCHEMA_VERSION || existing.size != size || existing.max_joints != (uint32_t)MAX_JOINTS)
+        {
+            close(fd);
+            throw std::runtime_error(std::string("Shared memory segment ") + name +
+                                     " has version " + std::to_string(existing.version) +
+                                     ", size " + std::to_string(existing.size) +
+                                     ", " + std::to_string(existing.max_joints) + " joints capacity but this process expects version " +
+                                     std::to_string(IPC_SCHEMA_VERSION) + ", size " + std::to_string(size) +
+                                     ", " + std::to_string(MAX_JOINTS) + " joints capacity. Rebuild all processes or remove /dev/shm/" + name + ".");
+        }
+    }
+    else if (ftruncate(fd, map_size) == -1)
+    {
+        if (hugepage_dir != nullptr)
+        {
+            return abandon();
+        }
+        close(fd);
+        throw std::runtime_error(std::string("Failed to size shared memory object ") + name + ".");
+    }
+
+    // Fault every page in now instead of on first touch inside the RT loop
+    void *ptr = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        if (hugepage_dir != nullptr)
+        {
+            return abandon();
+        }
+        close(fd);
+        throw std::runtime_error("Failed to map shared memory.");
+    }
+    close(fd);
+
+    if (mlock(ptr, map_size) == -1)
+    {
+        fprintf(stderr, "Warning: Failed to lock shared memory %s: %s\n", name, strerror(errno));
+    }
+
+    SegmentHeader *header = static_cast<SegmentHeader *>(ptr);
+    char *payload = static_cast<char *>(ptr) + payload_offset;
+
+    if (initialize)
+    {
+        // A stale segment still holds the old layout, start from zero like a fresh one
+        if (!created)
+        {
+            header->magic.store(0, std::memory_order_relaxed);
+            memset(payload, 0, size);
+        }
+        header->version = IPC_SCHEMA_VERSION;
+        header->size = size;
+        header->max_joints = MAX_JOINTS;
+        header->magic.store(IPC_SEGMENT_MAGIC, std::memory_order_release);
+    }
+
+    mapped_length = map_size;
+    return payload;
+}
+
+void *openSharedSegment(const char *name, size_t size)
+{
+    std::lock_guard<std::mutex> guard(mappingsLock);
+
+    for (auto &[payload, mapping] : mappings)
+    {
+        if (mapping.name == name)
+        {
+            if (mapping.size != size)
+            {
+                throw std::runtime_error(std::string("Shared memory segment ") + name + " is already mapped with size " +
+                                         std::to_string(mapping.size) + ", not " + std::to_string(size) + ".");
+            }
+            mapping.users++;
+            return payload;
+        }
+    }
+
+    void *payload = nullptr;
+    size_t mapped_length = 0;
+    const char *hugepage_dir = getenv(IPC_HUGEPAGES_ENV);
+    if (hugepage_dir != nullptr && *hugepage_dir != '\0')
+    {
+        payload = openSegment(name, size, hugepage_dir, mapped_length);
+        if (payload == nullptr)
+        {
+            fprintf(stderr, "Warning: No huge pages for %s in %s, falling back to 4K pages\n", name, hugepage_dir);
+        }
+    }
+    if (payload == nullptr)
+    {
+        payload = openSegment(name, size, nullptr, mapped_length);
+    }
+
+    mappings[payload] = {name, size, mapped_length, 1};
+    return payload;
+}
+
+std::string segmentName(const char *name, int line)
+{
+    if (line < 0)
+    {
+        const char *line_env = getenv(IPC_LINE_ENV);
+        line = line_env != nullptr ? atoi(line_env) : 0;
+    }
+    return line > 0 ? std::string(name) + "." + std::to_string(line) : std::string(name);
+}
+
+void closeSharedSegment(void *payload, size_t size)
+{
+    std::lock_guard<std::mutex> guard(mappingsLock);
+
+    auto mapping = mappings.find(payload);
+    size_t map_size = sizeof(SegmentHeader) + size;
+    if (mapping != mappings.end())
+    {
+        if (--mapping->second.users > 0)
+        {
+            return;
+        }
+        map_size = mapping->second.length;
+        mappings.erase(mapping);
+    }
+    munmap(static_cast<char *>(payload) - sizeof(SegmentHeader), map_size);
+}
+
+void PageFaultMonitor::start()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    cycles = 0;
+    minor_faults = usage.ru_minflt;
+    major_faults = usage.ru_majflt;
+}
+
+void PageFaultMonitor::tick(RtLogger &log)
+{
+    if (++cycles != PAGE_FAULT_REPORT_CYCLES)
+    {
+        return;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    log.info("%ld minor / %ld major page faults in the first %lu cycles",
+             usage.ru_minflt - minor_faults, usage.ru_majflt - major_faults, (unsigned long)cycles);
+}
+
+static void add_relaxed(std::atomic<uint64_t> &counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+bool parseOverrunPolicy(const char *name, OverrunPolicy &policy)
+{
+    if (strcmp(name, "skip") == 0)
+    {
+        policy = OverrunPolicy::SKIP;
+    }
+    else if (strcmp(name, "reanchor") == 0)
+    {
+        policy = OverrunPolicy::REANCHOR;
+    }
+    else if (strcmp(name, "catch-up") == 0)
+    {
+        policy = OverrunPolicy::CATCH_UP;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+void CycleMonitor::start(CycleTaskStats *cycle_stats)
+{
+    stats = cycle_stats;
+    stats->setZero();
+    consecutiveOverruns = 0;
+    wakeOnEvent();
+}
+
+void CycleMonitor::wake(const struct timespec &release)
+{
+    wakeNs = monotonic_ns();
+    releaseNs = (int64_t)release.tv_sec * 1000000000 + release.tv_nsec;
+    stats->wakeup_latency.record(wakeNs > releaseNs ? wakeNs - releaseNs : 0);
+}
+
+void CycleMonitor::wakeOnEvent()
+{
+    wakeNs = monotonic_ns();
+    releaseNs = wakeNs;
+}
+
+void CycleMonitor::sleep(long period_ns)
+{
+    int64_t now = monotonic_ns();
+    stats->compute_time.record(now - wakeNs);
+    add_relaxed(stats->cycles, 1);
+    if (now <= releaseNs + period_ns)
+    {
+        consecutiveOverruns = 0;
+        return;
+    }
+
+    add_relaxed(stats->overruns, 1);
+    if (++consecutiveOverruns == OVERRUN_FAULT_CYCLES)
+    {
+        add_relaxed(stats->overrun_faults, 1);
+    }
+}
+
+void CycleMonitor::advance(struct timespec &release, long period_ns)
+{
+    int64_t next_ns = (int64_t)release.tv_sec * 1000000000 + release.tv_nsec + period_ns;
+    int64_t now = monotonic_ns();
+    int64_t missed = 0;
+
+    if (next_ns < now)
+    {
+        int64_t behind = (now - next_ns) / period_ns; // whole periods past the next release
+        switch (policy)
+        {
+        case OverrunPolicy::SKIP:
+            missed = behind + 1;
+            next_ns += missed * period_ns;
+            break;
+        case OverrunPolicy::REANCHOR:
+            missed = behind;
+            next_ns = now;
+            break;
+        case OverrunPolicy::CATCH_UP:
+            missed = std::max<int64_t>(behind - OVERRUN_CATCH_UP_CYCLES + 1, 0);
+            next_ns += missed * period_ns;
+            break;
+        }
+        add_relaxed(stats->missed_releases, missed);
+    }
+
+    release.tv_sec = next_ns / 1000000000;
+    release.tv_nsec = next_ns % 1000000000;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include "SharedObject.h"
+#include "RtLogger.h"
+
+// Every segment starts with this header, the payload follows on the next cache
+// line. The creator fills in version, size and max_joints and publishes magic
+// last; everyone else validates the header before touching the payload.
+constexpr uint32_t IPC_SEGMENT_MAGIC = 0x49504331; // "IPC1"
+
+struct alignas(CACHE_LINE_SIZE) SegmentHeader
+{
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t size; // payload size in bytes
+    uint32_t max_joints;
+};
+
+// Segments live in /dev/shm by default. Setting INSTRUMENT_IPC_HUGEPAGES to a
+// hugetlbfs mount (e.g. /dev/hugepages) backs them with huge pages instead, with
+// a fallback to 4K pages if none are available; all processes must agree on it.
+// Either way every segment is pre-faulted and locked when it is mapped.
+constexpr const char *IPC_HUGEPAGES_ENV = "INSTRUMENT_IPC_HUGEPAGES";
+
+// Creates or attaches the shared memory segment `name` and returns a pointer to
+// its payload. Throws std::runtime_error if the segment exists but was built
+// against a different schema version, payload size or MAX_JOINTS. Within one
+// process a segment is mapped once, later opens return the same payload and
+// every open needs its own close.
+void *openSharedSegment(const char *name, size_t size);
+void closeSharedSegment(void *payload, size_t size);
+
+// Every EtherCAT line has its own set of segments, named "<name>.<line>" for
+// lines other than 0. A process serving one line picks it with
+// INSTRUMENT_IPC_LINE, ecat_master passes the line of each of its masters.
+constexpr const char *IPC_LINE_ENV = "INSTRUMENT_IPC_LINE";
+
+// line -1 takes the line from INSTRUMENT_IPC_LINE, 0 if it is not set
+std::string segmentName(const char *name, int line = -1);
+
+template <typename T>
+T *mapSegment(const char *name, int line = -1)
+{
+    return static_cast<T *>(openSharedSegment(segmentName(name, line).c_str(), sizeof(T)));
+}
+
+template <typename T>
+void unmapSegment(T *ptr)
+{
+    if (ptr != nullptr)
+    {
+        closeSharedSegment(ptr, sizeof(T));
+    }
+}
+
+// Counts the page faults the RT thread takes during its first
+// PAGE_FAULT_REPORT_CYCLES cycles and logs them once
+constexpr uint64_t PAGE_FAULT_REPORT_CYCLES = 10000;
+
+struct PageFaultMonitor
+{
+    void start();
+    void tick(RtLogger &log); // once per cycle
+
+    uint64_t cycles = 0;
+    long minor_faults = 0;
+    long major_faults = 0;
+};
+
+// What a cyclic loop does when its next release time has already passed
+enum class OverrunPolicy
+{
+    SKIP,     // drop the missed releases and stay on the original grid
+    REANCHOR, // run right away and restart the grid from there
+    CATCH_UP, // run missed cycles back to back, but at most OVERRUN_CATCH_UP_CYCLES of them
+};
+
+constexpr long OVERRUN_CATCH_UP_CYCLES = 2;
+
+// "skip", "reanchor" or "catch-up", false for anything else
+bool parseOverrunPolicy(const char *name, OverrunPolicy &policy);
+
+// Feeds one RT loop's CycleTaskStats. Call wake() right after the loop's sleep
+// returns with the release time it slept until (wakeOnEvent() if another
+// process woke it instead) and sleep() right before it goes to sleep again.
+// advance() moves a release time on by one period and applies the overrun
+// policy. Only clock_gettime, no allocation and no other syscalls.
+struct CycleMonitor
+{
+    void start(CycleTaskStats *stats);
+    void wake(const struct timespec &release);
+    void wakeOnEvent();
+    void sleep(long period_ns);
+    void advance(struct timespec &release, long period_ns);
+
+    OverrunPolicy policy = OverrunPolicy::SKIP;
+    CycleTaskStats *stats = nullptr;
+    int64_t releaseNs = 0;
+    int64_t wakeNs = 0;
+    uint32_t consecutiveOverruns = 0;
+};
@@ -0,0 +1,1352 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <climits>
+#include <endian.h>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <cmath>
+
+// Shared memory schema used by ecat_master, safety_controller,
+// instrument_motion_planner and the clients. Fields written by different
+// processes are kept on separate cache lines. Bump IPC_SCHEMA_VERSION whenever
+// a layout in this file changes so stale segments are rejected at start-up.
+constexpr uint32_t IPC_SCHEMA_VERSION = 8;
+
+// Per-joint arrays are sized for MAX_JOINTS drives, three instruments. The
+// number actually on the bus is found by ecat_master's bus scan at start-up and
+// published in SystemStateData::num_joints; entries beyond it are unused.
+constexpr int MAX_JOINTS = 12;
+constexpr int JOINTS_PER_INSTRUMENT = 4;
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr int SEQLOCK_MAX_RETRIES = 16; // Readers give up and keep their last snapshot after this
+
+// The safety controller picks the cycle period (--period-us) and publishes it
+// before safety_ready, ecat_master and the motion planner follow it. Supported
+// periods divide 1 ms evenly and are at least 250 us: 250 us, 500 us and 1 ms.
+constexpr uint32_t DEFAULT_CYCLE_PERIOD_NS = 1000000;
+constexpr uint32_t MIN_CYCLE_PERIOD_NS = 250000;
+
+constexpr bool isSupportedCyclePeriod(uint32_t period_ns)
+{
+    return period_ns >= MIN_CYCLE_PERIOD_NS && period_ns <= DEFAULT_CYCLE_PERIOD_NS && DEFAULT_CYCLE_PERIOD_NS % period_ns == 0;
+}
+
+// structer for system data
+enum class SystemState
+{
+    POWER_OFF,
+    READY,
+    IN_EXECUTION,
+    RECOVERY,
+    ERROR
+};
+
+enum class ActuatorState
+{
+    NONE,
+    STERILE_MOUNTED,
+    STERILE_ENGAGED,
+    INSTRUMENT_MOUNTED,
+    INSTRUMENT_ENGAGED
+};
+
+enum class CommandType
+{
+    NONE,
+    JOG,
+    HAND_CONTROL,
+    MOVE_TO,
+};
+
+enum class DriveState
+{
+    INITIALIZE,
+    NOT_READY_TO_SWITCH_ON,
+    SWITCHED_ON,
+    OPERATION_ENABLED,
+    ERROR,
+};
+
+enum class OperationModeState
+{
+    POSITION_MODE = 8,
+    VELOCITY_MODE = 9,
+    TORQUE_MODE = 10,
+};
+
+enum class SafetyStates
+{
+    INITIALIZE,
+    READY_FOR_OPERATION,
+    OPERATION,
+    ERROR,
+    RECOVERY,
+};
+
+// Legal transitions of the state machines shared between processes. Writers go
+// through transitionState() so a process acting on a stale state fails the
+// compare-and-swap instead of overwriting a newer state. Any state may fall
+// into ERROR.
+constexpr bool isLegalTransition(DriveState from, DriveState to)
+{
+    switch (to)
+    {
+    case DriveState::INITIALIZE:
+        return from == DriveState::ERROR;
+    case DriveState::NOT_READY_TO_SWITCH_ON:
+        return from == DriveState::INITIALIZE;
+    case DriveState::SWITCHED_ON:
+        return from == DriveState::INITIALIZE || from == DriveState::NOT_READY_TO_SWITCH_ON;
+    case DriveState::OPERATION_ENABLED:
+        return from == DriveState::SWITCHED_ON;
+    case DriveState::ERROR:
+        return from != DriveState::ERROR;
+    }
+    return false;
+}
+
+constexpr bool isLegalTransition(SafetyStates from, SafetyStates to)
+{
+    switch (to)
+    {
+    case SafetyStates::INITIALIZE:
+        return false; // only entered at start-up
+    case SafetyStates::READY_FOR_OPERATION:
+        return from == SafetyStates::INITIALIZE || from == SafetyStates::ERROR || from == SafetyStates::RECOVERY;
+    case SafetyStates::OPERATION:
+        return from == SafetyStates::READY_FOR_OPERATION;
+    case SafetyStates::RECOVERY:
+        return from == SafetyStates::INITIALIZE;
+    case SafetyStates::ERROR:
+        return from != SafetyStates::ERROR;
+    }
+    return false;
+}
+
+constexpr bool isLegalTransition(SystemState from, SystemState to)
+{
+    switch (to)
+    {
+    case SystemState::POWER_OFF:
+        return from == SystemState::READY || from == SystemState::ERROR;
+    case SystemState::READY:
+        return from == SystemState::POWER_OFF || from == SystemState::IN_EXECUTION || from == SystemState::RECOVERY || from == SystemState::ERROR;
+    case SystemState::IN_EXECUTION:
+        return from == SystemState::READY;
+    case SystemState::RECOVERY:
+        return from == SystemState::READY || from == SystemState::IN_EXECUTION || from == SystemState::ERROR;
+    case SystemState::ERROR:
+        return from != SystemState::ERROR;
+    }
+    return false;
+}
+
+// Moves state from `from` to `to`. Fails if the transition is illegal or state
+// is no longer `from`; on failure `from` holds the current state.
+template <typename State>
+bool transitionState(std::atomic<State> &state, State &from, State to)
+{
+    return isLegalTransition(from, to) &&
+           state.compare_exchange_strong(from, to, std::memory_order_acq_rel, std::memory_order_acquire);
+}
+
+// Moves state to `to` from whatever it currently is, if that is legal
+template <typename State>
+bool transitionState(std::atomic<State> &state, State to)
+{
+    State current = state.load(std::memory_order_acquire);
+    while (isLegalTransition(current, to))
+    {
+        if (state.compare_exchange_weak(current, to, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Lockstep waits have no deadline, they only wake this often to check for SIGINT
+constexpr long LOCKSTEP_POLL_NS = 100000000;
+
+// Cycle notification between the RT processes through a shared futex. signal()
+// bumps the sequence and wakes all waiters, wait() sleeps until the sequence
+// moves past the value the caller last saw or the absolute CLOCK_MONOTONIC
+// deadline passes. Returns false on timeout or signal interruption.
+//
+// In lockstep simulation an event is either a request or the answer to one:
+// the answering side acknowledge()s the sequence of the request it handled and
+// the requester waitFor()s exactly that value, so a stale answer never
+// releases a newer request.
+struct alignas(CACHE_LINE_SIZE) CycleEvent
+{
+    void reset() { sequence.store(0, std::memory_order_relaxed); }
+
+    uint32_t current() const { return sequence.load(std::memory_order_acquire); }
+
+    uint32_t signal()
+    {
+        uint32_t value = sequence.fetch_add(1, std::memory_order_release) + 1;
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&sequence), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        return value;
+    }
+
+    void acknowledge(uint32_t request)
+    {
+        sequence.store(request, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&sequence), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+
+    bool wait(uint32_t seen, const struct timespec *deadline)
+    {
+        while (sequence.load(std::memory_order_acquire) == seen)
+        {
+            if (syscall(SYS_futex, reinterpret_cast<uint32_t *>(&sequence), FUTEX_WAIT_BITSET, seen, deadline, NULL, FUTEX_BITSET_MATCH_ANY) == -1 && errno != EAGAIN)
+            {
+                return sequence.load(std::memory_order_acquire) != seen;
+            }
+        }
+        return true;
+    }
+
+    // No deadline: until the sequence moves past seen, false once stop is set
+    bool waitPast(uint32_t seen, const volatile sig_atomic_t &stop)
+    {
+        while (!stop)
+        {
+            struct timespec deadline = pollDeadline();
+            if (wait(seen, &deadline))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // No deadline: until the sequence is value, false once stop is set
+    bool waitFor(uint32_t value, const volatile sig_atomic_t &stop)
+    {
+        while (!stop)
+        {
+            uint32_t seen = current();
+            if (seen == value)
+            {
+                return true;
+            }
+            struct timespec deadline = pollDeadline();
+            wait(seen, &deadline);
+        }
+        return false;
+    }
+
+    std::atomic<uint32_t> sequence;
+
+private:
+    static struct timespec pollDeadline()
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += LOCKSTEP_POLL_NS;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        return deadline;
+    }
+};
+
+inline int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Start-up milestone shared through a futex. set() records when the milestone
+// was reached and wakes every waiter, wait() blocks until it is reached or the
+// relative timeout passes. Stays set until reset() at the next start-up.
+struct alignas(CACHE_LINE_SIZE) Milestone
+{
+    void reset()
+    {
+        reached.store(0, std::memory_order_relaxed);
+        timestamp_ns = 0;
+    }
+
+    bool isSet() const { return reached.load(std::memory_order_acquire) != 0; }
+
+    void set()
+    {
+        if (isSet())
+        {
+            return;
+        }
+        timestamp_ns = monotonic_ns();
+        reached.store(1, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&reached), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+
+    bool wait(const struct timespec *timeout = NULL)
+    {
+        while (!isSet())
+        {
+            if (syscall(SYS_futex, reinterpret_cast<uint32_t *>(&reached), FUTEX_WAIT, 0, timeout, NULL, 0) == -1 && errno != EAGAIN)
+            {
+                return isSet();
+            }
+        }
+        return true;
+    }
+
+    std::atomic<uint32_t> reached;
+    int64_t timestamp_ns; // CLOCK_MONOTONIC time set() was first called
+};
+
+// Sequence lock for data published by a single writer process and read by
+// others. The sequence is odd while an update is in progress; readers copy the
+// data and retry if the sequence was odd or changed underneath them. The writer
+// never waits, so it is safe to use from the 1 kHz EtherCAT loop.
+struct SeqLock
+{
+    void reset() { sequence.store(0, std::memory_order_relaxed); }
+
+    void writeBegin()
+    {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void writeEnd()
+    {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    uint32_t readBegin() const { return sequence.load(std::memory_order_acquire); }
+
+    // true if the data copied since readBegin() is consistent
+    bool readValid(uint32_t start) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return (start & 1) == 0 && sequence.load(std::memory_order_relaxed) == start;
+    }
+
+    std::atomic<uint32_t> sequence;
+};
+
+// CiA402 power state of a drive as reported by its statusword (0x6041). The
+// state lives in bits 0-3, 5 and 6; those six bits index a table built at
+// compile time, so decoding is one lookup instead of a chain of mask tests and
+// patterns outside the standard come out as UNKNOWN.
+enum class Cia402State : uint8_t
+{
+    UNKNOWN,
+    NOT_READY_TO_SWITCH_ON,
+    SWITCH_ON_DISABLED,
+    READY_TO_SWITCH_ON,
+    SWITCHED_ON,
+    OPERATION_ENABLED,
+    QUICK_STOP_ACTIVE,
+    FAULT_REACTION_ACTIVE,
+    FAULT,
+};
+
+constexpr uint16_t SW_VOLTAGE_ENABLED = 0x0010;
+constexpr uint16_t SW_WARNING = 0x0080;
+constexpr uint16_t SW_REMOTE = 0x0200;
+constexpr uint16_t SW_TARGET_REACHED = 0x0400;
+constexpr uint16_t SW_INTERNAL_LIMIT = 0x0800;
+
+// Reference decoding straight from the CiA402 state table, only used to build
+// CIA402_STATE_TABLE
+constexpr Cia402State cia402StateOf(uint16_t statusword)
+{
+    switch (statusword & 0x004F)
+    {
+    case 0x0000:
+        return Cia402State::NOT_READY_TO_SWITCH_ON;
+    case 0x0040:
+        return Cia402State::SWITCH_ON_DISABLED;
+    case 0x000F:
+        return Cia402State::FAULT_REACTION_ACTIVE;
+    case 0x0008:
+        return Cia402State::FAULT;
+    }
+    switch (statusword & 0x006F)
+    {
+    case 0x0021:
+        return Cia402State::READY_TO_SWITCH_ON;
+    case 0x0023:
+        return Cia402State::SWITCHED_ON;
+    case 0x0027:
+        return Cia402State::OPERATION_ENABLED;
+    case 0x0007:
+        return Cia402State::QUICK_STOP_ACTIVE;
+    }
+    return Cia402State::UNKNOWN;
+}
+
+// Bits 0-3 stay in place, bits 5 and 6 move down to 4 and 5
+constexpr int cia402StateIndex(uint16_t statusword)
+{
+    return (statusword & 0x000F) | ((statusword >> 1) & 0x0030);
+}
+
+struct Cia402StateTable
+{
+    Cia402State states[64];
+};
+
+constexpr Cia402StateTable makeCia402StateTable()
+{
+    Cia402StateTable table = {};
+    for (int index = 0; index < 64; index++)
+    {
+        table.states[index] = cia402StateOf((uint16_t)((index & 0x0F) | ((index & 0x30) << 1)));
+    }
+    return table;
+}
+
+constexpr Cia402StateTable CIA402_STATE_TABLE = makeCia402StateTable();
+
+// Decoded statusword of one drive, published per joint by ecat_master
+struct DriveStatus
+{
+    uint16_t statusword;
+    Cia402State state;
+    bool voltage_enabled;
+    bool warning;
+    bool target_reached;
+    bool internal_limit;
+};
+
+constexpr DriveStatus decodeStatusword(uint16_t statusword)
+{
+    return {statusword,
+            CIA402_STATE_TABLE.states[cia402StateIndex(statusword)],
+            (statusword & SW_VOLTAGE_ENABLED) != 0,
+            (statusword & SW_WARNING) != 0,
+            (statusword & SW_TARGET_REACHED) != 0,
+            (statusword & SW_INTERNAL_LIMIT) != 0};
+}
+
+static_assert(decodeStatusword(0x0250).state == Cia402State::SWITCH_ON_DISABLED &&
+                  decodeStatusword(0x0231).state == Cia402State::READY_TO_SWITCH_ON &&
+                  decodeStatusword(0x0233).state == Cia402State::SWITCHED_ON &&
+                  decodeStatusword(0x0637).state == Cia402State::OPERATION_ENABLED &&
+                  decodeStatusword(0x0217).state == Cia402State::QUICK_STOP_ACTIVE &&
+                  decodeStatusword(0x021F).state == Cia402State::FAULT_REACTION_ACTIVE &&
+                  decodeStatusword(0x0218).state == Cia402State::FAULT &&
+                  decodeStatusword(0x0001).state == Cia402State::UNKNOWN,
+              "CiA402 statusword table");
+
+inline const char *cia402StateName(Cia402State state)
+{
+    switch (state)
+    {
+    case Cia402State::NOT_READY_TO_SWITCH_ON:
+        return "not ready to switch on";
+    case Cia402State::SWITCH_ON_DISABLED:
+        return "switch on disabled";
+    case Cia402State::READY_TO_SWITCH_ON:
+        return "ready to switch on";
+    case Cia402State::SWITCHED_ON:
+        return "switched on";
+    case Cia402State::OPERATION_ENABLED:
+        return "operation enabled";
+    case Cia402State::QUICK_STOP_ACTIVE:
+        return "quick stop active";
+    case Cia402State::FAULT_REACTION_ACTIVE:
+        return "fault reaction active";
+    case Cia402State::FAULT:
+        return "fault";
+    default:
+        return "unknown";
+    }
+}
+
+struct JointData
+{
+    void setZero()
+    {
+        feedback_lock.reset();
+        command_lock.reset();
+        std::fill_n(joint_position, MAX_JOINTS, 0.0);
+        std::fill_n(joint_velocity, MAX_JOINTS, 0.0);
+        std::fill_n(joint_torque, MAX_JOINTS, 0.0);
+        std::fill_n(drive_status, MAX_JOINTS, DriveStatus{});
+        std::fill_n(target_position, MAX_JOINTS, 0.0);
+        std::fill_n(target_velocity, MAX_JOINTS, 0.0);
+        std::fill_n(target_torque, MAX_JOINTS, 0.0);
+        sterile_detection_status = false;
+        instrument_detection_status = false;
+        feedback_timestamp_ns = 0;
+        target_source_timestamp_ns = 0;
+    }
+
+    // Feedback block, written by ecat_master under feedback_lock
+    alignas(CACHE_LINE_SIZE) SeqLock feedback_lock;
+    double joint_position[MAX_JOINTS];
+    double joint_velocity[MAX_JOINTS];
+    double joint_torque[MAX_JOINTS];
+    DriveStatus drive_status[MAX_JOINTS]; // every cycle, unless the process image is exported
+    bool sterile_detection_status;
+    bool instrument_detection_status;
+    int64_t feedback_timestamp_ns; // CLOCK_MONOTONIC time of the process image this came from
+
+    // Command block, written by safety_controller under command_lock
+    alignas(CACHE_LINE_SIZE) SeqLock command_lock;
+    double target_position[MAX_JOINTS];
+    double target_velocity[MAX_JOINTS];
+    double target_torque[MAX_JOINTS];
+    int64_t target_source_timestamp_ns; // feedback_timestamp_ns the targets were planned from
+};
+
+// The two JointData blocks as instrument_rt hands them from ecat_master to the
+// safety controller's stage by reference, never shared and never locked
+struct JointFeedback
+{
+    double joint_position[MAX_JOINTS];
+    double joint_velocity[MAX_JOINTS];
+    double joint_torque[MAX_JOINTS];
+    DriveStatus drive_status[MAX_JOINTS];
+    bool sterile_detection_status;
+    bool instrument_detection_status;
+    int64_t feedback_timestamp_ns;
+};
+
+struct JointTargets
+{
+    double target_position[MAX_JOINTS];
+    double target_velocity[MAX_JOINTS];
+    double target_torque[MAX_JOINTS];
+    int64_t target_source_timestamp_ns;
+};
+
+// PDO byte offsets of one drive inside the domain process data
+struct JointPdos
+{
+    unsigned int statusword;
+    unsigned int mode_of_operation_display;
+    unsigned int position_actual_value;
+    unsigned int velocity_actual_value;
+    unsigned int torque_actual_value;
+    unsigned int error_code;
+    unsigned int controlword;
+    unsigned int modes_of_operation;
+    unsigned int target_torque;
+    unsigned int target_position;
+    unsigned int max_current;
+    unsigned int current_actual_value;
+};
+
+// Raw EtherCAT process image exported by ecat_master (--export-process-image).
+// Consumers decode the PDOs they need straight from data[] using offsets[]
+// instead of going through the JointData doubles. size is zero while no
+// master is exporting. The diagnostics (mode display, error code, current)
+// are read over SDO and not in the process image, their offsets stay zero.
+constexpr size_t PROCESS_IMAGE_MAX_SIZE = 1024;
+
+struct ProcessImage
+{
+    void setZero()
+    {
+        lock.reset();
+        size = 0;
+        external = false;
+        timestamp_ns = 0;
+        memset(offsets, 0, sizeof(offsets));
+        memset(data, 0, sizeof(data));
+    }
+
+    SeqLock lock;          // odd while the master updates data[]
+    uint32_t size;         // ecrt_domain_size()
+    bool external;         // data[] is the domain memory itself (ecrt_domain_external_memory)
+    int64_t timestamp_ns;  // CLOCK_MONOTONIC time of the last ecrt_domain_process()
+    JointPdos offsets[MAX_JOINTS];
+    alignas(CACHE_LINE_SIZE) uint8_t data[PROCESS_IMAGE_MAX_SIZE];
+};
+
+inline uint16_t pdo_read_u16(const uint8_t *data)
+{
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return le16toh(value);
+}
+
+inline int16_t pdo_read_s16(const uint8_t *data)
+{
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return (int16_t)le16toh(value);
+}
+
+inline int32_t pdo_read_s32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return (int32_t)le32toh(value);
+}
+
+struct SystemStateData
+{
+    void setZero()
+    {
+        drive_state.store(DriveState::ERROR, std::memory_order_relaxed);
+        drive_operation_mode = OperationModeState::POSITION_MODE;
+        safety_state.store(SafetyStates::INITIALIZE, std::memory_order_relaxed);
+        initialize_drives = false;
+        switch_to_operation = false;
+
+        status_switched_on = false;
+        status_operation_enabled = false;
+        safety_controller_enabled = false;
+        trigger_error_mode = false;
+
+        safety_check_done = false;
+        start_safety_check = false;
+        std::fill_n(drive_enable_for_operation, MAX_JOINTS, false);
+        cycle_period_ns = DEFAULT_CYCLE_PERIOD_NS;
+        master_cycle.reset();
+        safety_ready.reset();
+        dc_sync_error_ns = 0;
+        dc_slave_deviation_ns = 0;
+        simulation_mode = false;
+        safety_cycle.reset();
+        virtual_time_ns = 0;
+        lockstep_tick.reset();
+        lockstep_done.reset();
+        lockstep_joined.reset();
+    }
+
+    DriveState getDriveState() const { return drive_state.load(std::memory_order_acquire); }
+    bool setDriveState(DriveState from, DriveState to) { return transitionState(drive_state, from, to); }
+    bool setDriveState(DriveState to) { return transitionState(drive_state, to); }
+
+    SafetyStates getSafetyState() const { return safety_state.load(std::memory_order_acquire); }
+    bool setSafetyState(SafetyStates from, SafetyStates to) { return transitionState(safety_state, from, to); }
+    bool setSafetyState(SafetyStates to) { return transitionState(safety_state, to); }
+
+    // Written by ecat_master
+    alignas(CACHE_LINE_SIZE) std::atomic<DriveState> drive_state;
+    bool status_switched_on;
+    bool status_operation_enabled;
+    bool start_safety_check;
+    int32_t dc_sync_error_ns;        // master cycle against the DC reference clock, 0 without --dc
+    uint32_t dc_slave_deviation_ns;  // largest slave clock deviation from the sync monitor
+    // Drives found by the bus scan, at most MAX_JOINTS. Not cleared by setZero(),
+    // ecat_master sets it before its first cycle and the others may start later
+    std::atomic<uint32_t> num_joints;
+
+    // Written by safety_controller
+    alignas(CACHE_LINE_SIZE) std::atomic<SafetyStates> safety_state;
+    OperationModeState drive_operation_mode;
+    bool safety_controller_enabled;
+    bool trigger_error_mode;
+    bool safety_check_done;
+    bool initialize_drives;
+    bool switch_to_operation;
+    bool drive_enable_for_operation[MAX_JOINTS];
+    uint32_t cycle_period_ns; // valid once safety_ready is set
+    bool simulation_mode;     // AppData::simulation_mode for ecat_master, never cleared once set
+
+    // Signalled by ecat_master once per cycle after the process image is decoded
+    CycleEvent master_cycle;
+    Milestone safety_ready; // safety controller is running its cycle
+    CycleEvent safety_cycle; // lockstep: safety controller acknowledges the master_cycle it completed
+
+    // Lockstep simulation, driven by lockstep_driver. Every cycle runs
+    //   lockstep_driver -> ecat_master -> safety controller -> planner
+    // and is acknowledged back up the chain before the next one is released.
+    // No process sleeps on the clock, cycle times come from virtual_time_ns.
+    int64_t virtual_time_ns;  // time of the cycle released by lockstep_tick
+    CycleEvent lockstep_tick; // lockstep_driver -> ecat_master, run one cycle
+    CycleEvent lockstep_done; // ecat_master acknowledges the lockstep_tick it completed
+    Milestone lockstep_joined; // ecat_master waits for lockstep_tick from now on
+};
+
+// Newest complete setpoint vector from the motion planner to the safety
+// controller. The planner fills back() and publishes it, the safety controller
+// swaps in the newest published buffer with update(). Neither side blocks and a
+// consumer never sees a half written vector.
+struct alignas(CACHE_LINE_SIZE) Setpoint
+{
+    uint64_t sequence;
+    double position[MAX_JOINTS];
+    double velocity[MAX_JOINTS];
+    double torque[MAX_JOINTS];
+    OperationModeState mode;
+    int64_t feedback_timestamp_ns; // sensor sample this setpoint was planned from
+};
+
+struct SetpointBuffer
+{
+    static constexpr uint8_t INDEX_MASK = 0x03;
+    static constexpr uint8_t FRESH = 0x04;
+
+    void setZero()
+    {
+        for (Setpoint &buffer : buffers)
+        {
+            buffer.sequence = 0;
+            std::fill_n(buffer.position, MAX_JOINTS, 0.0);
+            std::fill_n(buffer.velocity, MAX_JOINTS, 0.0);
+            std::fill_n(buffer.torque, MAX_JOINTS, 0.0);
+            buffer.mode = OperationModeState::POSITION_MODE;
+            buffer.feedback_timestamp_ns = 0;
+        }
+        back_index = 0;
+        published = 0;
+        middle.store(1, std::memory_order_relaxed);
+        front_index = 2;
+    }
+
+    // Producer side (motion planner)
+    Setpoint &back() { return buffers[back_index]; }
+
+    void publish()
+    {
+        buffers[back_index].sequence = ++published;
+        back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Consumer side (safety controller), true if a newer setpoint is now in front()
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+        {
+            return false;
+        }
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const Setpoint &front() const { return buffers[front_index]; }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint8_t> middle;
+    alignas(CACHE_LINE_SIZE) uint8_t back_index; // written by the motion planner
+    uint64_t published;
+    alignas(CACHE_LINE_SIZE) uint8_t front_index; // written by the safety controller
+    Setpoint buffers[3];
+};
+
+struct AppData
+{
+    void setZero()
+    {
+        // Initialize boolean flags
+        switch_to_operation = false;
+        initialize_drives = false;
+        initialize_system = false;
+        trigger_error = false;
+        safety_process_status = false;
+        drive_initialized = false;
+        safety_check_done = false;
+        reset_error = false;
+        operation_enable_status = false;
+
+        // Use std::fill_n for array initialization
+        std::fill_n(actual_position, MAX_JOINTS, 0.0);
+        std::fill_n(actual_velocity, MAX_JOINTS, 0.0);
+        std::fill_n(actual_torque, MAX_JOINTS, 0.0);
+        std::fill_n(cart_pos, MAX_JOINTS, 0.0);
+        std::fill_n(target_position, MAX_JOINTS, 0.0);
+        std::fill_n(target_velocity, MAX_JOINTS, 0.0);
+        std::fill_n(target_torque, MAX_JOINTS, 0.0);
+
+        // Initialize other members
+        drive_operation_mode = OperationModeState::POSITION_MODE;
+        switched_on = false;
+        sterile_detection = false;
+        instrument_detection = false;
+        simulation_mode = false;
+        feedback_timestamp_ns = 0;
+    }
+
+    // Written by safety_controller
+    alignas(CACHE_LINE_SIZE) double actual_position[MAX_JOINTS];
+    double actual_velocity[MAX_JOINTS];
+    double actual_torque[MAX_JOINTS];
+    double target_position[MAX_JOINTS];
+    double target_velocity[MAX_JOINTS];
+    double target_torque[MAX_JOINTS];
+    int64_t feedback_timestamp_ns;
+    bool switched_on;
+    bool sterile_detection;
+    bool instrument_detection;
+    bool trigger_error;
+    bool safety_process_status;
+    bool drive_initialized;
+    bool safety_check_done;
+    bool operation_enable_status;
+
+    // Written by instrument_motion_planner
+    alignas(CACHE_LINE_SIZE) double cart_pos[MAX_JOINTS];
+    OperationModeState drive_operation_mode;
+    bool initialize_system;
+    bool initialize_drives;
+    bool switch_to_operation;
+
+    // Written by the clients
+    alignas(CACHE_LINE_SIZE) bool reset_error;
+    bool simulation_mode; // set by lockstep_driver, the RT processes switch to lockstep for good
+
+    // Not cleared by setZero(), these are only reset once at start-up
+    SetpointBuffer setpoint;
+    CycleEvent safety_cycle;  // safety controller -> motion planner, feedback is ready
+    CycleEvent planner_cycle; // motion planner -> safety controller, setpoint is ready (acknowledges safety_cycle in lockstep)
+    uint32_t cycle_period_ns; // written by safety_controller at start-up, 0 before its first run
+
+    // Start-up milestones, each only reset at start-up by the process that sets
+    // it, so the processes can start in any order
+    Milestone planner_ready;   // motion planner is running and accepts requests
+    Milestone drives_ready;    // all drives switched on
+    Milestone operation_ready; // drives enabled and safety controller in OPERATION
+};
+
+// Once-per-cycle snapshot broadcast by the safety controller to any number of
+// passive readers (GUIs, loggers). The producer never waits: each slot carries
+// its own sequence, odd while being written and 2 * index + 2 once sample
+// `index` is complete, so a reader that falls more than a lap behind sees the
+// sequence move on and reports an overrun instead of a torn sample.
+constexpr uint32_t TELEMETRY_RING_CAPACITY = 1024; // must be a power of two, ~1 s at 1 kHz
+
+struct TelemetrySample
+{
+    uint64_t index;
+    int64_t timestamp_ns;          // CLOCK_MONOTONIC time the sample was published, virtual time in lockstep
+    int64_t feedback_timestamp_ns; // sensor sample the actual values came from
+    double actual_position[MAX_JOINTS];
+    double actual_velocity[MAX_JOINTS];
+    double actual_torque[MAX_JOINTS];
+    double target_position[MAX_JOINTS];
+    double target_velocity[MAX_JOINTS];
+    double target_torque[MAX_JOINTS];
+    DriveState drive_state;
+    SafetyStates safety_state;
+    OperationModeState drive_operation_mode;
+    int32_t dc_sync_error_ns;
+    uint32_t dc_slave_deviation_ns;
+    uint32_t num_joints; // valid entries in the per-joint arrays
+    DriveStatus drive_status[MAX_JOINTS];
+};
+
+struct alignas(CACHE_LINE_SIZE) TelemetrySlot
+{
+    std::atomic<uint64_t> sequence;
+    TelemetrySample sample;
+};
+
+struct TelemetryRing
+{
+    void setZero()
+    {
+        for (TelemetrySlot &slot : slots)
+        {
+            slot.sequence.store(0, std::memory_order_relaxed);
+        }
+        head.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side (safety controller), fill in the sample and publish()
+    TelemetrySample &next()
+    {
+        uint64_t index = head.load(std::memory_order_relaxed);
+        TelemetrySlot &slot = slots[index & (TELEMETRY_RING_CAPACITY - 1)];
+        slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.sample.index = index;
+        return slot.sample;
+    }
+
+    void publish()
+    {
+        uint64_t index = head.load(std::memory_order_relaxed);
+        slots[index & (TELEMETRY_RING_CAPACITY - 1)].sequence.store(2 * index + 2, std::memory_order_release);
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; // samples published so far
+    TelemetrySlot slots[TELEMETRY_RING_CAPACITY];
+};
+
+// Reader side, lives in the reader's own memory so readers never write to the
+// ring. Starts at the newest sample.
+struct TelemetryCursor
+{
+    enum class Result
+    {
+        EMPTY,
+        SAMPLE,
+        OVERRUN,
+    };
+
+    explicit TelemetryCursor(const TelemetryRing *ring)
+        : ring(ring), position(ring->head.load(std::memory_order_acquire)) {}
+
+    // SAMPLE: sample holds the next record. OVERRUN: the producer lapped us,
+    // `missed` samples were lost and the cursor moved to the oldest one left.
+    Result read(TelemetrySample &sample)
+    {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        if (position == head)
+        {
+            return Result::EMPTY;
+        }
+        if (head - position > TELEMETRY_RING_CAPACITY)
+        {
+            return skip(head);
+        }
+
+        const TelemetrySlot &slot = ring->slots[position & (TELEMETRY_RING_CAPACITY - 1)];
+        uint64_t expected = 2 * position + 2;
+        if (slot.sequence.load(std::memory_order_acquire) != expected)
+        {
+            return skip(ring->head.load(std::memory_order_acquire));
+        }
+
+        sample = slot.sample;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != expected)
+        {
+            return skip(ring->head.load(std::memory_order_acquire));
+        }
+
+        position++;
+        return Result::SAMPLE;
+    }
+
+    const TelemetryRing *ring;
+    uint64_t position;
+    uint64_t missed = 0;
+
+private:
+    Result skip(uint64_t head)
+    {
+        // Leave one slot of headroom for the sample the producer is writing now
+        uint64_t oldest = head > TELEMETRY_RING_CAPACITY - 1 ? head - (TELEMETRY_RING_CAPACITY - 1) : 0;
+        missed = oldest > position ? oldest - position : 1;
+        position = std::max(oldest, position + 1);
+        return Result::OVERRUN;
+    }
+};
+
+// Fixed-bucket, HDR-style histogram of nanosecond durations: one bucket per
+// value below 32 ns, then 16 linear sub-buckets per power of two (at most
+// 6.25 % error) up to ~68 s. Each histogram has a single writer that uses
+// relaxed loads and stores, readers may miss a sample in flight but never see
+// a torn counter.
+constexpr int HISTOGRAM_SUB_BUCKET_BITS = 4;
+constexpr int HISTOGRAM_LINEAR_BITS = HISTOGRAM_SUB_BUCKET_BITS + 1;
+constexpr int HISTOGRAM_MAX_EXPONENT = 35;
+constexpr int HISTOGRAM_BUCKETS = (1 << HISTOGRAM_LINEAR_BITS) +
+                                  (HISTOGRAM_MAX_EXPONENT - HISTOGRAM_LINEAR_BITS + 1) * (1 << HISTOGRAM_SUB_BUCKET_BITS);
+
+struct alignas(CACHE_LINE_SIZE) Histogram
+{
+    static int bucketIndex(uint64_t value)
+    {
+        if (value < (1u << HISTOGRAM_LINEAR_BITS))
+        {
+            return (int)value;
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        if (exponent > HISTOGRAM_MAX_EXPONENT)
+        {
+            return HISTOGRAM_BUCKETS - 1;
+        }
+        int shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+        int sub_bucket = (int)(value >> shift) - (1 << HISTOGRAM_SUB_BUCKET_BITS);
+        return (1 << HISTOGRAM_LINEAR_BITS) + (exponent - HISTOGRAM_LINEAR_BITS) * (1 << HISTOGRAM_SUB_BUCKET_BITS) + sub_bucket;
+    }
+
+    // Largest value that lands in bucket `index`
+    static uint64_t bucketLimit(int index)
+    {
+        if (index < (1 << HISTOGRAM_LINEAR_BITS))
+        {
+            return index;
+        }
+        int log_index = index - (1 << HISTOGRAM_LINEAR_BITS);
+        int exponent = HISTOGRAM_LINEAR_BITS + (log_index >> HISTOGRAM_SUB_BUCKET_BITS);
+        uint64_t mantissa = (1 << HISTOGRAM_SUB_BUCKET_BITS) + (log_index & ((1 << HISTOGRAM_SUB_BUCKET_BITS) - 1));
+        return ((mantissa + 1) << (exponent - HISTOGRAM_SUB_BUCKET_BITS)) - 1;
+    }
+
+    void setZero()
+    {
+        for (std::atomic<uint64_t> &count : counts)
+        {
+            count.store(0, std::memory_order_relaxed);
+        }
+        max_ns.store(0, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t value_ns)
+    {
+        std::atomic<uint64_t> &count = counts[bucketIndex(value_ns)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (value_ns > max_ns.load(std::memory_order_relaxed))
+        {
+            max_ns.store(value_ns, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> counts[HISTOGRAM_BUCKETS];
+};
+
+// Cycle timing of one RT loop, written only by that loop. An overrun is a
+// cycle whose compute time ran past the next release time, overrun_faults
+// counts runs of OVERRUN_FAULT_CYCLES consecutive overruns and is watched by
+// the safety controller.
+constexpr uint32_t OVERRUN_FAULT_CYCLES = 10;
+
+struct CycleTaskStats
+{
+    void setZero()
+    {
+        cycles.store(0, std::memory_order_relaxed);
+        overruns.store(0, std::memory_order_relaxed);
+        missed_releases.store(0, std::memory_order_relaxed);
+        overrun_faults.store(0, std::memory_order_relaxed);
+        wakeup_latency.setZero();
+        compute_time.setZero();
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> overruns;
+    std::atomic<uint64_t> missed_releases; // release times dropped by the overrun policy
+    std::atomic<uint64_t> overrun_faults;
+    Histogram wakeup_latency; // release time to the loop actually running
+    Histogram compute_time;   // wake-up to the loop going back to sleep
+};
+
+struct CycleStats
+{
+    CycleTaskStats master;
+    CycleTaskStats safety;
+    CycleTaskStats planner;
+};
+
+struct SystemData
+{
+    void setZero()
+    {
+        system_state.store(SystemState::POWER_OFF, std::memory_order_relaxed);
+        previous_state = SystemState::POWER_OFF;
+        actuator_state = ActuatorState::NONE;
+        request = 0;
+    }
+
+    SystemState getSystemState() const { return system_state.load(std::memory_order_acquire); }
+
+    // false if `state` is not reachable from the current state
+    bool setSystemState(SystemState state)
+    {
+        SystemState current = system_state.load(std::memory_order_acquire);
+        while (isLegalTransition(current, state))
+        {
+            if (system_state.compare_exchange_weak(current, state, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                previous_state = current;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ActuatorState getActuatorState() const { return actuator_state; }
+    void setActuatorState(ActuatorState state) {actuator_state = state; }
+    void powerOn() { request = getSystemState() == SystemState::POWER_OFF ? 1 : 0; }
+    void powerOff() { request = getSystemState() == SystemState::READY ? -1 : 0; }
+
+    void resetError()
+    {
+        SystemState current = SystemState::ERROR;
+        SystemState target = previous_state == SystemState::IN_EXECUTION ? SystemState::READY : previous_state;
+        if (transitionState(system_state, current, target))
+        {
+            previous_state = current;
+        }
+    }
+
+    // Written by the clients
+    alignas(CACHE_LINE_SIZE) int request = 0;
+
+private:
+    // Written by instrument_motion_planner
+    alignas(CACHE_LINE_SIZE) std::atomic<SystemState> system_state{SystemState::POWER_OFF};
+    SystemState previous_state = SystemState::POWER_OFF;
+    ActuatorState actuator_state = ActuatorState::NONE;
+};
+
+static_assert(std::atomic<DriveState>::is_always_lock_free &&
+                  std::atomic<SafetyStates>::is_always_lock_free &&
+                  std::atomic<SystemState>::is_always_lock_free,
+              "shared state machines must be lock-free to live in shared memory");
+
+// Fixed-capacity single-producer (client) / single-consumer (motion planner)
+// command ring. head and tail live on their own cache lines so the two sides
+// never share a line, and neither side ever blocks.
+constexpr uint32_t COMMAND_QUEUE_CAPACITY = 64; // must be a power of two
+
+struct JogCommand
+{
+    int index;
+    int dir;
+    int type;
+};
+
+struct MoveToCommand
+{
+    int type;
+    double goal_position[3];
+};
+
+struct alignas(CACHE_LINE_SIZE) Command
+{
+    void setNone() { type = CommandType::NONE; }
+
+    uint64_t sequence;
+    CommandType type;
+    union
+    {
+        JogCommand jog_data;
+        MoveToCommand move_to_data;
+    };
+};
+
+struct CommandQueue
+{
+    void setZero()
+    {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        next_sequence = 0;
+    }
+
+    // Producer side, returns false if the queue is full
+    bool push(Command command)
+    {
+        uint32_t write_index = tail.load(std::memory_order_relaxed);
+        if (write_index - head.load(std::memory_order_acquire) == COMMAND_QUEUE_CAPACITY)
+        {
+            return false;
+        }
+
+        command.sequence = ++next_sequence;
+        entries[write_index & (COMMAND_QUEUE_CAPACITY - 1)] = command;
+        tail.store(write_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pushJog(int index, int dir, int mode)
+    {
+        Command command = {};
+        command.type = CommandType::JOG;
+        command.jog_data.index = index - 1;
+        command.jog_data.dir = dir;
+        command.jog_data.type = mode;
+        return push(command);
+    }
+
+    bool pushHandControl()
+    {
+        Command command = {};
+        command.type = CommandType::HAND_CONTROL;
+        return push(command);
+    }
+
+    bool pushMoveTo(int type, const double goal_position[3])
+    {
+        Command command = {};
+        command.type = CommandType::MOVE_TO;
+        command.move_to_data.type = type;
+        std::copy_n(goal_position, 3, command.move_to_data.goal_position);
+        return push(command);
+    }
+
+    // Stops whatever the planner is executing
+    bool pushNone()
+    {
+        Command command = {};
+        command.type = CommandType::NONE;
+        return push(command);
+    }
+
+    // Consumer side, O(1), returns false if nothing is queued
+    bool pop(Command &command)
+    {
+        uint32_t read_index = head.load(std::memory_order_relaxed);
+        if (read_index == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        command = entries[read_index & (COMMAND_QUEUE_CAPACITY - 1)];
+        head.store(read_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, looks at the next command without taking it
+    bool peek(Command &command) const
+    {
+        uint32_t read_index = head.load(std::memory_order_relaxed);
+        if (read_index == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        command = entries[read_index & (COMMAND_QUEUE_CAPACITY - 1)];
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> head; // written by the motion planner
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail; // written by the client
+    uint64_t next_sequence;
+    Command entries[COMMAND_QUEUE_CAPACITY];
+};
+
+struct ForceDimData
+{
+    void setZero()
+    {
+        gripper_pos = 0;
+        gripper_vel = 0;
+
+        // Use std::fill_n for array initialization
+        std::fill_n(cart_pos, 3, 0.0);
+        std::fill_n(cart_linear_vel, 3, 0.0);
+        std::fill_n(cart_angular_vel, 3, 0.0);
+        std::fill_n(cart_orient, 9, 0.0);
+    }
+
+    double cart_pos[3];
+    double cart_linear_vel[3];
+    double cart_orient[9];
+    double cart_angular_vel[3];
+    double gripper_pos;
+    double gripper_vel;
+};
+// Asynchronous SDO access to the drives for non-RT clients. A client claims a
+// FREE slot with submit() and gets its index back; ecat_master starts PENDING
+// slots on the drive's SDO request handle from its cycle, oldest first and one
+// per drive at a time, and polls them once per cycle until they end DONE or
+// FAILED. The client collects the result with poll() and frees the slot with
+// release(). The cycle never waits for the mailbox.
+constexpr int SDO_QUEUE_SLOTS = 16;
+constexpr uint32_t SDO_TIMEOUT_MS = 500;
+
+enum class SdoSlotState : uint8_t
+{
+    FREE,
+    CLAIMED, // client is filling in the request
+    PENDING, // waiting for the drive's SDO request handle
+    BUSY,    // transfer running
+    DONE,
+    FAILED,
+};
+
+struct alignas(CACHE_LINE_SIZE) SdoSlot
+{
+    std::atomic<SdoSlotState> state;
+    uint64_t sequence; // submission order
+    uint8_t joint;
+    bool write;
+    uint8_t size; // 1, 2 or 4 bytes
+    uint8_t subindex;
+    uint16_t index;
+    uint32_t value; // written value, or the value read once DONE
+};
+
+struct SdoQueue
+{
+    void setZero()
+    {
+        for (SdoSlot &slot : slots)
+        {
+            slot.state.store(SdoSlotState::FREE, std::memory_order_relaxed);
+        }
+        next_sequence.store(0, std::memory_order_relaxed);
+    }
+
+    // Client side, returns the slot or -1 if the request is invalid or all slots are in use
+    int submit(int joint, uint16_t index, uint8_t subindex, uint8_t size, bool write, uint32_t value)
+    {
+        if (joint < 0 || joint >= MAX_JOINTS || (size != 1 && size != 2 && size != 4))
+        {
+            return -1;
+        }
+
+        for (int slot_ctr = 0; slot_ctr < SDO_QUEUE_SLOTS; slot_ctr++)
+        {
+            SdoSlot &slot = slots[slot_ctr];
+            SdoSlotState expected = SdoSlotState::FREE;
+            if (!slot.state.compare_exchange_strong(expected, SdoSlotState::CLAIMED, std::memory_order_acquire))
+            {
+                continue;
+            }
+
+            slot.sequence = next_sequence.fetch_add(1, std::memory_order_relaxed);
+            slot.joint = joint;
+            slot.write = write;
+            slot.size = size;
+            slot.subindex = subindex;
+            slot.index = index;
+            slot.value = value;
+            slot.state.store(SdoSlotState::PENDING, std::memory_order_release);
+            return slot_ctr;
+        }
+        return -1;
+    }
+
+    // DONE or FAILED once the transfer has ended, value holds what was read
+    SdoSlotState poll(int slot, uint32_t &value) const
+    {
+        SdoSlotState state = slots[slot].state.load(std::memory_order_acquire);
+        if (state == SdoSlotState::DONE)
+        {
+            value = slots[slot].value;
+        }
+        return state;
+    }
+
+    void release(int slot)
+    {
+        slots[slot].state.store(SdoSlotState::FREE, std::memory_order_release);
+    }
+
+    // ecat_master side: oldest PENDING slot for `joint`, -1 if there is none
+    int nextPending(int joint) const
+    {
+        int next = -1;
+        for (int slot_ctr = 0; slot_ctr < SDO_QUEUE_SLOTS; slot_ctr++)
+        {
+            const SdoSlot &slot = slots[slot_ctr];
+            if (slot.state.load(std::memory_order_acquire) == SdoSlotState::PENDING && slot.joint == joint &&
+                (next == -1 || slot.sequence < slots[next].sequence))
+            {
+                next = slot_ctr;
+            }
+        }
+        return next;
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> next_sequence;
+    SdoSlot slots[SDO_QUEUE_SLOTS];
+};
@@ -0,0 +1,101 @@
+// Prints live wake-up latency and compute time percentiles of the RT loops
+// from the "CycleStats" segment. Percentiles are bucket limits, so they are at
+// most 6.25 % high; max is exact.
+//
+// usage: cycle_stats [interval_ms]
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "SharedMemory.h"
+
+static volatile sig_atomic_t exitFlag = 0;
+
+static void signalHandler(int)
+{
+    exitFlag = 1;
+}
+
+struct HistogramSnapshot
+{
+    void take(const Histogram &histogram)
+    {
+        total = 0;
+        for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+        {
+            counts[bucket] = histogram.counts[bucket].load(std::memory_order_relaxed);
+            total += counts[bucket];
+        }
+        max_ns = histogram.max_ns.load(std::memory_order_relaxed);
+    }
+
+    // Smallest bucket limit with at least `fraction` of the samples at or below it
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t rank = (uint64_t)ceil(fraction * total);
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+        {
+            seen += counts[bucket];
+            if (seen >= rank && seen > 0)
+            {
+                return std::min(Histogram::bucketLimit(bucket), max_ns);
+            }
+        }
+        return max_ns;
+    }
+
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max_ns;
+};
+
+static void print_histogram(const char *label, const Histogram &histogram)
+{
+    static HistogramSnapshot snapshot;
+    snapshot.take(histogram);
+    printf("  %-8s p50 %8.1f  p99 %8.1f  p99.99 %8.1f  max %8.1f us\n", label,
+           snapshot.percentile(0.5) / 1e3, snapshot.percentile(0.99) / 1e3,
+           snapshot.percentile(0.9999) / 1e3, snapshot.max_ns / 1e3);
+}
+
+static void print_task(const char *name, const CycleTaskStats &stats)
+{
+    uint64_t cycles = stats.cycles.load(std::memory_order_relaxed);
+    if (cycles == 0)
+    {
+        return;
+    }
+    printf("%s: %lu cycles, %lu overruns, %lu missed releases, %lu overrun faults\n", name, (unsigned long)cycles,
+           (unsigned long)stats.overruns.load(std::memory_order_relaxed),
+           (unsigned long)stats.missed_releases.load(std::memory_order_relaxed),
+           (unsigned long)stats.overrun_faults.load(std::memory_order_relaxed));
+    print_histogram("wake-up", stats.wakeup_latency);
+    print_histogram("compute", stats.compute_time);
+}
+
+int main(int argc, char **argv)
+{
+    long interval_ms = argc > 1 ? strtol(argv[1], NULL, 10) : 1000;
+    if (interval_ms <= 0)
+    {
+        interval_ms = 1000;
+    }
+
+    signal(SIGINT, signalHandler);
+
+    CycleStats *statsPtr = mapSegment<CycleStats>("CycleStats");
+
+    while (!exitFlag)
+    {
+        print_task("ecat_master", statsPtr->master);
+        print_task("safety_controller", statsPtr->safety);
+        print_task("instrument_motion_planner", statsPtr->planner);
+        printf("\n");
+        usleep(interval_ms * 1000);
+    }
+
+    unmapSegment(statsPtr);
+    return 0;
+}
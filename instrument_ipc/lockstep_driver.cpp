@@ -0,0 +1,157 @@
+// Steps ecat_master_sim, the safety controller and the planner in lockstep on
+// a virtual clock and plays the operator the way without_gui does: it
+// requests start-up and queues hand control once operation is enabled, both at
+// fixed cycles. Every cycle's telemetry goes into a hash, two runs with the
+// same options are bit-identical if their hashes match.
+//
+// Start the stack as usual (ecat_master_sim, safety controller, planner), then
+// this tool instead of without_gui. The stack stays paused in lockstep when it
+// is done, stop it with SIGINT.
+//
+// usage: lockstep_driver [--cycles N] [--request-at N]
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "SharedMemory.h"
+
+constexpr uint64_t DEFAULT_LOCKSTEP_CYCLES = 10000;
+constexpr uint64_t DEFAULT_REQUEST_CYCLE = 10;
+constexpr time_t LOCKSTEP_JOIN_TIMEOUT_S = 2;
+
+static volatile sig_atomic_t exitFlag = 0;
+
+static void signalHandler(int)
+{
+    exitFlag = 1;
+}
+
+// FNV-1a
+static uint64_t fold(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t byte = 0; byte < size; byte++)
+    {
+        hash = (hash ^ bytes[byte]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Everything that follows from the simulation, not the ring position or DC clock offsets
+static uint64_t fold_sample(uint64_t hash, const TelemetrySample &sample)
+{
+    size_t joints = std::min(sample.num_joints, (uint32_t)MAX_JOINTS) * sizeof(double);
+    hash = fold(hash, &sample.timestamp_ns, sizeof(sample.timestamp_ns));
+    hash = fold(hash, &sample.feedback_timestamp_ns, sizeof(sample.feedback_timestamp_ns));
+    hash = fold(hash, sample.actual_position, joints);
+    hash = fold(hash, sample.actual_velocity, joints);
+    hash = fold(hash, sample.actual_torque, joints);
+    hash = fold(hash, sample.target_position, joints);
+    hash = fold(hash, sample.target_velocity, joints);
+    hash = fold(hash, sample.target_torque, joints);
+    hash = fold(hash, &sample.drive_state, sizeof(sample.drive_state));
+    hash = fold(hash, &sample.safety_state, sizeof(sample.safety_state));
+    return fold(hash, &sample.drive_operation_mode, sizeof(sample.drive_operation_mode));
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t cycles = DEFAULT_LOCKSTEP_CYCLES;
+    uint64_t request_cycle = DEFAULT_REQUEST_CYCLE;
+
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc)
+        {
+            cycles = strtoull(argv[++arg], NULL, 10);
+        }
+        else if (strcmp(argv[arg], "--request-at") == 0 && arg + 1 < argc)
+        {
+            request_cycle = strtoull(argv[++arg], NULL, 10);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--cycles N] [--request-at N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (cycles == 0 || request_cycle == 0)
+    {
+        fprintf(stderr, "Cycles are counted from 1.\n");
+        return 1;
+    }
+
+    signal(SIGINT, signalHandler);
+
+    SystemStateData *systemStateDataPtr = mapSegment<SystemStateData>("SystemStateData");
+    AppData *appDataPtr = mapSegment<AppData>("AppData");
+    SystemData *systemDataPtr = mapSegment<SystemData>("SystemData");
+    CommandQueue *commandQueuePtr = mapSegment<CommandQueue>("CommandQueue");
+    TelemetryRing *telemetryPtr = mapSegment<TelemetryRing>("Telemetry");
+
+    // Both reset the shared state on start-up, nothing has been requested before this
+    systemStateDataPtr->safety_ready.wait();
+    appDataPtr->planner_ready.wait();
+    int64_t period_ns = systemStateDataPtr->cycle_period_ns;
+
+    appDataPtr->simulation_mode = true;
+    struct timespec join_timeout = {LOCKSTEP_JOIN_TIMEOUT_S, 0};
+    if (!systemStateDataPtr->lockstep_joined.wait(&join_timeout))
+    {
+        fprintf(stderr, "ecat_master did not join lockstep, only ecat_master_sim can.\n");
+        return 1;
+    }
+
+    TelemetryCursor cursor(telemetryPtr);
+    TelemetrySample sample;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t samples = 0;
+    uint64_t operation_cycle = 0;
+    uint64_t cycle = 0;
+
+    int64_t start_ns = monotonic_ns();
+    while (cycle < cycles && !exitFlag)
+    {
+        cycle++;
+        if (cycle == request_cycle)
+        {
+            systemDataPtr->request = 1;
+        }
+        if (operation_cycle == 0 && appDataPtr->operation_enable_status)
+        {
+            operation_cycle = cycle;
+            commandQueuePtr->pushHandControl();
+        }
+
+        systemStateDataPtr->virtual_time_ns = cycle * period_ns;
+        uint32_t tick = systemStateDataPtr->lockstep_tick.signal();
+        if (!systemStateDataPtr->lockstep_done.waitFor(tick, exitFlag))
+        {
+            break;
+        }
+
+        while (cursor.read(sample) == TelemetryCursor::Result::SAMPLE)
+        {
+            hash = fold_sample(hash, sample);
+            samples++;
+        }
+    }
+    int64_t elapsed_ns = monotonic_ns() - start_ns;
+
+    printf("%lu cycles of %ld us in %.3f s, %.1f us per cycle (%.0fx real time)\n", cycle, period_ns / 1000,
+           elapsed_ns / 1e9, elapsed_ns / 1e3 / std::max<uint64_t>(cycle, 1),
+           (double)cycle * period_ns / std::max<int64_t>(elapsed_ns, 1));
+    if (operation_cycle != 0)
+    {
+        printf("Operation enabled at cycle %lu, hand control queued\n", operation_cycle);
+    }
+    printf("%lu samples, trajectory hash %016lx\n", samples, hash);
+
+    unmapSegment(telemetryPtr);
+    unmapSegment(commandQueuePtr);
+    unmapSegment(systemDataPtr);
+    unmapSegment(appDataPtr);
+    unmapSegment(systemStateDataPtr);
+    return samples == cycle ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+// Reads or writes one drive object through ecat_master's SDO queue while the
+// cycle keeps running, e.g. to change a current limit without a restart.
+//
+// usage: sdo_tool <joint> <index> <subindex> <size 1|2|4> [value]
+//        without a value the object is read
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "SharedMemory.h"
+
+constexpr useconds_t SDO_POLL_US = 1000;
+
+int main(int argc, char **argv)
+{
+    if (argc != 5 && argc != 6)
+    {
+        fprintf(stderr, "usage: %s <joint> <index> <subindex> <size 1|2|4> [value]\n", argv[0]);
+        return 1;
+    }
+
+    int joint = strtol(argv[1], NULL, 0);
+    uint16_t index = strtoul(argv[2], NULL, 0);
+    uint8_t subindex = strtoul(argv[3], NULL, 0);
+    uint8_t size = strtoul(argv[4], NULL, 0);
+    bool write = argc == 6;
+    uint32_t value = write ? strtoul(argv[5], NULL, 0) : 0;
+
+    SystemStateData *systemStateDataPtr = mapSegment<SystemStateData>("SystemStateData");
+    uint32_t num_joints = systemStateDataPtr->num_joints.load(std::memory_order_acquire);
+    unmapSegment(systemStateDataPtr);
+    if (joint < 0 || (uint32_t)joint >= num_joints)
+    {
+        fprintf(stderr, "Joint %d is not on the bus, ecat_master found %u drives.\n", joint, num_joints);
+        return 1;
+    }
+
+    SdoQueue *sdoQueuePtr = mapSegment<SdoQueue>("SdoQueue");
+
+    int slot = sdoQueuePtr->submit(joint, index, subindex, size, write, value);
+    if (slot < 0)
+    {
+        fprintf(stderr, "Request rejected, check joint and size or retry when the queue has room.\n");
+        unmapSegment(sdoQueuePtr);
+        return 1;
+    }
+
+    // The master gives up on the drive after SDO_TIMEOUT_MS, allow for queueing behind other requests
+    SdoSlotState state = SdoSlotState::PENDING;
+    for (uint32_t waited_ms = 0; waited_ms < 4 * SDO_TIMEOUT_MS; waited_ms++)
+    {
+        state = sdoQueuePtr->poll(slot, value);
+        if (state == SdoSlotState::DONE || state == SdoSlotState::FAILED)
+        {
+            break;
+        }
+        usleep(SDO_POLL_US);
+    }
+
+    int status = 0;
+    if (state == SdoSlotState::DONE)
+    {
+        if (write)
+        {
+            printf("joint %d 0x%04X:%02X written\n", joint, index, subindex);
+        }
+        else
+        {
+            printf("joint %d 0x%04X:%02X = %u (0x%X)\n", joint, index, subindex, value, value);
+        }
+        sdoQueuePtr->release(slot);
+    }
+    else if (state == SdoSlotState::FAILED)
+    {
+        fprintf(stderr, "SDO transfer failed.\n");
+        sdoQueuePtr->release(slot);
+        status = 1;
+    }
+    else
+    {
+        // Leave the slot to the master, freeing it now could hand it to another request mid-transfer
+        fprintf(stderr, "No answer from ecat_master, is it running?\n");
+        status = 1;
+    }
+
+    unmapSegment(sdoQueuePtr);
+    return status;
+}
@@ -0,0 +1,79 @@
+// Follows the telemetry ring published by the safety controller and prints
+// every Nth sample. Overruns are reported instead of silently skipping samples.
+//
+// usage: telemetry_reader [print_every]
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "SharedMemory.h"
+
+static volatile sig_atomic_t exitFlag = 0;
+
+static void signalHandler(int)
+{
+    exitFlag = 1;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t print_every = argc > 1 ? strtoull(argv[1], NULL, 10) : 100;
+    if (print_every == 0)
+    {
+        print_every = 1;
+    }
+
+    signal(SIGINT, signalHandler);
+
+    TelemetryRing *telemetryPtr = mapSegment<TelemetryRing>("Telemetry");
+    TelemetryCursor cursor(telemetryPtr);
+    TelemetrySample sample;
+
+    uint64_t received = 0;
+    uint64_t missed = 0;
+    uint64_t overruns = 0;
+
+    while (!exitFlag)
+    {
+        TelemetryCursor::Result result = cursor.read(sample);
+
+        if (result == TelemetryCursor::Result::EMPTY)
+        {
+            usleep(1000);
+            continue;
+        }
+        if (result == TelemetryCursor::Result::OVERRUN)
+        {
+            overruns++;
+            missed += cursor.missed;
+            printf("overrun: lost %lu samples\n", (unsigned long)cursor.missed);
+            continue;
+        }
+
+        received++;
+        if (sample.index % print_every != 0)
+        {
+            continue;
+        }
+
+        printf("#%lu t=%ld drive=%d safety=%d mode=%d dc %d/%u ns",
+               (unsigned long)sample.index, (long)sample.timestamp_ns,
+               (int)sample.drive_state, (int)sample.safety_state, (int)sample.drive_operation_mode,
+               sample.dc_sync_error_ns, sample.dc_slave_deviation_ns);
+        for (uint32_t jnt_ctr = 0; jnt_ctr < sample.num_joints; jnt_ctr++)
+        {
+            printf(" | j%u sw 0x%04X pos %.4f/%.4f vel %.4f/%.4f tor %.4f/%.4f", jnt_ctr, sample.drive_status[jnt_ctr].statusword,
+                   sample.actual_position[jnt_ctr], sample.target_position[jnt_ctr],
+                   sample.actual_velocity[jnt_ctr], sample.target_velocity[jnt_ctr],
+                   sample.actual_torque[jnt_ctr], sample.target_torque[jnt_ctr]);
+        }
+        printf("\n");
+    }
+
+    printf("received %lu samples, %lu overruns, %lu samples lost\n",
+           (unsigned long)received, (unsigned long)overruns, (unsigned long)missed);
+
+    unmapSegment(telemetryPtr);
+    return 0;
+}
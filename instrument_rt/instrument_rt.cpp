@@ -0,0 +1,145 @@
+// Hosts ecat_master (line 0), the safety controller and the motion planner in
+// one process. Each cycle runs in ecat_master's RT thread in a fixed order:
+//
+//   receive -> decode -> safety read -> plan -> safety write -> send
+//
+// so targets go out in the frame of the cycle whose feedback they were
+// computed from, instead of up to three cycles later. The planner advances its
+// active command once per call, so the safety controller steps it inline and
+// the whole cycle runs in one thread. --planner-thread keeps the planner on a
+// thread of its own instead, handed each cycle as with --phase-lock.
+// The stages hand their data over by reference: ecat_master passes the decoded
+// feedback to the safety controller and gets the targets back, the inline
+// planner writes its setpoint straight into the safety controller's. Nothing
+// in the cycle goes through JointData's seqlocks or the setpoint triple buffer.
+// Segments are mapped once per process and shared by reference between the
+// components, client tools attach to them as usual.
+//
+// usage: instrument_rt [--period-us 250|500|1000] [--overrun-policy P] [--measure-latency]
+//                      [--export-process-image] [--dc] [--planner-thread]
+//                      [--free-run (instrument_rt_sim)]
+
+#include "master.h"
+#include "safety_controller.h"
+#include "instrument_motion_planner.h"
+
+int main(int argc, char **argv)
+{
+    uint32_t period_ns = DEFAULT_CYCLE_PERIOD_NS;
+    OverrunPolicy overrun_policy = OverrunPolicy::SKIP;
+    bool measure_latency = false;
+    bool export_process_image = false;
+    bool distributed_clocks = false;
+    bool planner_thread = false;
+#ifdef ECAT_SIMULATION
+    bool free_run = false;
+#endif
+
+    for (int arg_ctr = 1; arg_ctr < argc; arg_ctr++)
+    {
+        if (strcmp(argv[arg_ctr], "--period-us") == 0 && arg_ctr + 1 < argc)
+        {
+            period_ns = strtoul(argv[++arg_ctr], NULL, 10) * 1000;
+            if (!isSupportedCyclePeriod(period_ns))
+            {
+                fprintf(stderr, "Unsupported cycle period %s us, use 250, 500 or 1000.\n", argv[arg_ctr]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg_ctr], "--overrun-policy") == 0 && arg_ctr + 1 < argc)
+        {
+            if (!parseOverrunPolicy(argv[++arg_ctr], overrun_policy))
+            {
+                fprintf(stderr, "Unknown overrun policy %s, use skip, reanchor or catch-up.\n", argv[arg_ctr]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg_ctr], "--measure-latency") == 0)
+        {
+            measure_latency = true;
+        }
+        else if (strcmp(argv[arg_ctr], "--export-process-image") == 0)
+        {
+            export_process_image = true;
+        }
+        else if (strcmp(argv[arg_ctr], "--dc") == 0)
+        {
+            distributed_clocks = true;
+        }
+        else if (strcmp(argv[arg_ctr], "--planner-thread") == 0)
+        {
+            planner_thread = true;
+        }
+#ifdef ECAT_SIMULATION
+        else if (strcmp(argv[arg_ctr], "--free-run") == 0)
+        {
+            free_run = true;
+        }
+#endif
+    }
+
+    // Same order as starting the separate processes, each resets the segments it owns
+    EthercatMaster ecat_master(0);
+    SafetyController safety_ctrl;
+    InstrumentMotionPlanner motion_planner;
+
+    if (measure_latency)
+    {
+        ecat_master.enableLatencyMeasurement();
+    }
+    if (export_process_image)
+    {
+        ecat_master.enableProcessImageExport();
+    }
+    if (distributed_clocks)
+    {
+        ecat_master.enableDistributedClocks();
+    }
+#ifdef ECAT_SIMULATION
+    if (free_run)
+    {
+        ecat_master.enableFreeRun();
+    }
+#endif
+    ecat_master.setOverrunPolicy(overrun_policy);
+    motion_planner.setOverrunPolicy(overrun_policy);
+    safety_ctrl.setCyclePeriod(period_ns);
+    if (planner_thread)
+    {
+        safety_ctrl.enablePhaseLock();
+        motion_planner.enablePhaseLock();
+    }
+    else
+    {
+        safety_ctrl.setPlannerStage([&motion_planner](Setpoint &setpoint) { motion_planner.cycle(setpoint); });
+    }
+
+    ecat_master.setCycleStage([&safety_ctrl](const JointFeedback &feedback, JointTargets &targets) { safety_ctrl.cycle(feedback, targets); });
+
+    // Publishes the cycle period ecat_master waits for before activating
+    safety_ctrl.start();
+    std::thread planner;
+    if (planner_thread)
+    {
+        planner = std::thread(&InstrumentMotionPlanner::run, &motion_planner);
+    }
+    else
+    {
+        motion_planner.start();
+    }
+
+    ecat_master.run();
+
+    // ecat_master also stops when the safety controller is disabled, take the planner along
+    exitFlag = 1;
+    if (planner.joinable())
+    {
+        planner.join();
+    }
+    else
+    {
+        motion_planner.stop();
+    }
+    safety_ctrl.stop();
+    return 0;
+}
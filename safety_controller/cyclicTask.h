@@ -4,17 +4,45 @@
 
 void SafetyController::cyclicTask()
 {
-    struct period_info pinfo;
-
-    periodic_task_init(&pinfo);
+    periodic_task_init(&cycleInfo, cyclePeriodNs);
+    pageFaults.start();
+    cycleMonitor.start(&cycleStatsPtr->safety);
+    check_overruns(); // only faults from here on count
+    masterCycleSeen = systemStateDataPtr->master_cycle.current();
 
     while (!exitFlag)
     {
-        do_rt_task();
-        wait_rest_of_period(&pinfo);
+        cycle();
+        wait_for_cycle(&cycleInfo);
     }
 }
 
+void SafetyController::cycle()
+{
+    follow_simulation_mode();
+    plannerTicked = false;
+    do_rt_task();
+    publish_telemetry();
+
+    if ((simulationMode || plannerStage) && !plannerTicked)
+    {
+        // Lockstep or hosted inline: the planner runs every cycle, not only in OPERATION
+        run_planner_stage();
+    }
+    else if (phaseLock && !plannerTicked)
+    {
+        // Keep the planner locked to our cycle outside of OPERATION as well
+        appDataPtr->safety_cycle.signal();
+    }
+}
+
+void SafetyController::cycle(const JointFeedback &feedback, JointTargets &targets)
+{
+    stageFeedback = &feedback;
+    stageTargets = &targets;
+    cycle();
+}
+
 void SafetyController::inc_period(struct period_info *pinfo)
 {
 
@@ -28,21 +56,25 @@ void SafetyController::inc_period(struct period_info *pinfo)
     }
 }
 
-void SafetyController::periodic_task_init(struct period_info *pinfo)
+void SafetyController::periodic_task_init(struct period_info *pinfo, long period_ns)
 {
-    /* for simplicity, hardcoding a 1ms period */
-    pinfo->period_ns = 1000000;
+    pinfo->period_ns = period_ns;
 
     clock_gettime(CLOCK_MONOTONIC, &(pinfo->next_period));
 }
 
 void SafetyController::do_rt_task()
 {
+    // One snapshot per cycle so every decision below sees the same drive state
+    DriveState drive_state = systemStateDataPtr->getDriveState();
+    bool cycles_on_time = check_overruns() || simulationMode; // no deadlines in lockstep
+    numJoints = std::min(systemStateDataPtr->num_joints.load(std::memory_order_acquire), (uint32_t)MAX_JOINTS);
+
     // move initialize out of real
-    switch (systemStateDataPtr->safety_state)
+    switch (systemStateDataPtr->getSafetyState())
     {
     case SafetyStates::INITIALIZE:
-        if (systemStateDataPtr->drive_state == DriveState::INITIALIZE)
+        if (drive_state == DriveState::INITIALIZE)
         {
             // send signal to motion planner
             if (appDataPtr->initialize_system) // motion planner initialized?
@@ -51,27 +83,28 @@ void SafetyController::do_rt_task()
             }
         }
 
-        if (systemStateDataPtr->drive_state == DriveState::SWITCHED_ON)
+        if (drive_state == DriveState::SWITCHED_ON)
         {
             appDataPtr->drive_initialized = true;
+            appDataPtr->drives_ready.set();
             if (systemStateDataPtr->start_safety_check)
             {
                 read_data();
                 if (check_limits())
                 {
                     appDataPtr->trigger_error = false;
-                    systemStateDataPtr->safety_state = SafetyStates::READY_FOR_OPERATION;
+                    systemStateDataPtr->setSafetyState(SafetyStates::INITIALIZE, SafetyStates::READY_FOR_OPERATION);
                 }
                 else
                 {
                     appDataPtr->trigger_error = true;
-                    systemStateDataPtr->safety_state = SafetyStates::RECOVERY;
+                    systemStateDataPtr->setSafetyState(SafetyStates::INITIALIZE, SafetyStates::RECOVERY);
                 }
                 systemStateDataPtr->safety_check_done = true;
             }
         }
 
-        // if (systemStateDataPtr->drive_state == DriveState::ERROR)
+        // if (drive_state == DriveState::ERROR)
         // {
         //     // Take a command to reset Error From User
         //     // appDataPtr->drive_initialized = true;
@@ -82,56 +115,73 @@ void SafetyController::do_rt_task()
         check_limits();
         read_data();
 
-        for (int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+        for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
         {
             appDataPtr->target_position[jnt_ctr] = appDataPtr->actual_position[jnt_ctr];
             appDataPtr->target_velocity[jnt_ctr] = appDataPtr->actual_velocity[jnt_ctr];
             appDataPtr->target_torque[jnt_ctr] = appDataPtr->actual_torque[jnt_ctr];
         }
 
+        // Hold the current position, drop setpoints planned before operation
+        take_setpoint();
+
         if (appDataPtr->switch_to_operation) // switch to operation? from motion planner
         {
 
             systemStateDataPtr->switch_to_operation = true;
-            if (systemStateDataPtr->drive_state == DriveState::OPERATION_ENABLED)
+            if (drive_state == DriveState::OPERATION_ENABLED)
             {
-                systemStateDataPtr->safety_state = SafetyStates::OPERATION;
+                systemStateDataPtr->setSafetyState(SafetyStates::READY_FOR_OPERATION, SafetyStates::OPERATION);
             }
         }
         break;
     case SafetyStates::OPERATION:
-        if (systemStateDataPtr->drive_state == DriveState::OPERATION_ENABLED)
+        if (drive_state == DriveState::OPERATION_ENABLED)
         {
             appDataPtr->operation_enable_status = true;
+            appDataPtr->operation_ready.set();
             // read write
             read_data();
-            if (check_limits())
+            if (phaseLock || simulationMode || plannerStage)
+            {
+                run_planner_stage();
+            }
+            if (!cycles_on_time)
+            {
+                // One of the RT loops kept missing its deadline
+                rtLog.error("%u consecutive cycle overruns, leaving OPERATION", OVERRUN_FAULT_CYCLES);
+                appDataPtr->trigger_error = true;
+                systemStateDataPtr->setSafetyState(SafetyStates::OPERATION, SafetyStates::ERROR);
+            }
+            else if (check_limits())
             {
                 write_data();
             }
             else{
-                systemStateDataPtr->safety_state = SafetyStates::ERROR; 
+                systemStateDataPtr->setSafetyState(SafetyStates::OPERATION, SafetyStates::ERROR);
             }
         }
-        else if (systemStateDataPtr->drive_state == DriveState::ERROR)
+        else
         {
+            // Drives can only leave OPERATION_ENABLED through ERROR, treat any
+            // other state as the fault even if ERROR itself was already left
             appDataPtr->trigger_error = true;
-            systemStateDataPtr->safety_state = SafetyStates::ERROR;
+            systemStateDataPtr->setSafetyState(SafetyStates::OPERATION, SafetyStates::ERROR);
             // send signal to motion planner
         }
         break;
     case SafetyStates::ERROR:
         appDataPtr->setZero();
-        if (systemStateDataPtr->drive_state == DriveState::SWITCHED_ON)
+        if (drive_state == DriveState::SWITCHED_ON)
         {
-            systemStateDataPtr->safety_state = SafetyStates::READY_FOR_OPERATION;
+            systemStateDataPtr->setSafetyState(SafetyStates::ERROR, SafetyStates::READY_FOR_OPERATION);
         }
         break;
     case SafetyStates::RECOVERY:
         appDataPtr->setZero();
-        if (systemStateDataPtr->drive_state == DriveState::SWITCHED_ON)
+        if (drive_state == DriveState::SWITCHED_ON)
         {
-            systemStateDataPtr->safety_state = SafetyStates::READY_FOR_OPERATION;
+            systemStateDataPtr->setSafetyState(SafetyStates::RECOVERY, SafetyStates::READY_FOR_OPERATION);
         }
         break;
     default:
@@ -141,12 +191,115 @@ void SafetyController::do_rt_task()
 
 void SafetyController::wait_rest_of_period(struct period_info *pinfo)
 {
-    inc_period(pinfo);
+    cycleMonitor.advance(pinfo->next_period, pinfo->period_ns);
 
     /* for simplicity, ignoring possibilities of signal wakes */
     clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pinfo->next_period, NULL);
 }
 
+void SafetyController::wait_for_cycle(struct period_info *pinfo)
+{
+    pageFaults.tick(rtLog);
+    cycleMonitor.sleep(pinfo->period_ns);
+
+    if (simulationMode)
+    {
+        // Lockstep: tell the master this cycle is done, the next one starts on its next cycle
+        systemStateDataPtr->safety_cycle.acknowledge(masterCycleSeen);
+        systemStateDataPtr->master_cycle.waitPast(masterCycleSeen, exitFlag);
+        masterCycleSeen = systemStateDataPtr->master_cycle.current();
+        cycleMonitor.wakeOnEvent();
+        return;
+    }
+
+    if (!phaseLock)
+    {
+        wait_rest_of_period(pinfo);
+        cycleMonitor.wake(pinfo->next_period);
+        return;
+    }
+
+    // Wake on the master's cycle, fall back to our own clock half a period late
+    cycleMonitor.advance(pinfo->next_period, pinfo->period_ns);
+
+    struct period_info deadline = *pinfo;
+    deadline.period_ns = pinfo->period_ns / 2;
+    inc_period(&deadline);
+
+    if (systemStateDataPtr->master_cycle.wait(masterCycleSeen, &deadline.next_period))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &(pinfo->next_period));
+        cycleMonitor.wakeOnEvent();
+    }
+    else
+    {
+        cycleMonitor.wake(deadline.next_period);
+    }
+    masterCycleSeen = systemStateDataPtr->master_cycle.current();
+}
+
+void SafetyController::run_planner_stage()
+{
+    if (plannerStage)
+    {
+        plannerTicked = true;
+        uint64_t sequence = plannerSetpoint.sequence;
+        plannerStage(plannerSetpoint);
+        plannerSetpointFresh = plannerSetpointFresh || plannerSetpoint.sequence != sequence;
+        return;
+    }
+
+    // Hand this cycle's feedback to the planner and give it until mid-cycle to answer
+    uint32_t seen = appDataPtr->planner_cycle.current();
+    uint32_t request = appDataPtr->safety_cycle.signal();
+    plannerTicked = true;
+
+    if (simulationMode)
+    {
+        // Lockstep: no deadline, the planner acknowledges exactly this request
+        appDataPtr->planner_cycle.waitFor(request, exitFlag);
+        return;
+    }
+
+    struct period_info deadline;
+    deadline.period_ns = cycleInfo.period_ns / 2;
+    clock_gettime(CLOCK_MONOTONIC, &(deadline.next_period));
+    inc_period(&deadline);
+
+    appDataPtr->planner_cycle.wait(seen, &deadline.next_period);
+}
+
+// AppData::simulation_mode is cleared with the rest of AppData in ERROR, so
+// lockstep is kept once entered. Mirrored for ecat_master, which has no AppData.
+void SafetyController::follow_simulation_mode()
+{
+    if (!simulationMode && appDataPtr->simulation_mode)
+    {
+        simulationMode = true;
+        systemStateDataPtr->simulation_mode = true;
+        rtLog.info("Lockstep simulation, cycles follow ecat_master");
+    }
+}
+
+// false if any RT loop reported a new run of OVERRUN_FAULT_CYCLES overruns
+bool SafetyController::check_overruns()
+{
+    const CycleTaskStats *tasks[3] = {&cycleStatsPtr->master, &cycleStatsPtr->safety, &cycleStatsPtr->planner};
+    bool on_time = true;
+
+    for (int task_ctr = 0; task_ctr < 3; task_ctr++)
+    {
+        uint64_t faults = tasks[task_ctr]->overrun_faults.load(std::memory_order_relaxed);
+        // A loop that restarted zeroes its counters, that is not a fault
+        if (faults > overrunFaultsSeen[task_ctr])
+        {
+            on_time = false;
+        }
+        overrunFaultsSeen[task_ctr] = faults;
+    }
+    return on_time;
+}
+
 bool SafetyController::check_limits()
 {
 
@@ -159,9 +312,9 @@ bool SafetyController::check_limits()
 
 void SafetyController::joint_pos_limit_check()
 {
-    for (int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        if ((conv_to_actual_pos(jointDataPtr->joint_position[jnt_ctr], jnt_ctr)) > pos_limit[jnt_ctr])
+        if ((conv_to_actual_pos(jointDataPtr->joint_position[jnt_ctr], jnt_ctr)) > pos_limit[jnt_ctr % JOINTS_PER_INSTRUMENT])
         {
             systemStateDataPtr->trigger_error_mode = true;
         }
@@ -171,9 +324,9 @@ void SafetyController::joint_pos_limit_check()
 void SafetyController::joint_vel_limit_check()
 {
 
-    for (int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        if ((conv_to_actual_velocity(jointDataPtr->joint_velocity[jnt_ctr], jnt_ctr)) > vel_limit[jnt_ctr])
+        if ((conv_to_actual_velocity(jointDataPtr->joint_velocity[jnt_ctr], jnt_ctr)) > vel_limit[jnt_ctr % JOINTS_PER_INSTRUMENT])
         {
             systemStateDataPtr->trigger_error_mode = true;
         }
@@ -182,9 +335,9 @@ void SafetyController::joint_vel_limit_check()
 
 void SafetyController::joint_torq_limit_check()
 {
-    for (int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        if ((conv_to_actual_torque(jointDataPtr->joint_torque[jnt_ctr], jnt_ctr)) > torque_limit[jnt_ctr])
+        if ((conv_to_actual_torque(jointDataPtr->joint_torque[jnt_ctr], jnt_ctr)) > torque_limit[jnt_ctr % JOINTS_PER_INSTRUMENT])
         {
             systemStateDataPtr->trigger_error_mode = true;
         }
@@ -1,11 +1,42 @@
 #include "cyclicTask.h"
 
-int main()
+#ifndef INSTRUMENT_RT
+int main(int argc, char **argv)
 {
     SafetyController safety_ctrl;
+
+    for (int arg_ctr = 1; arg_ctr < argc; arg_ctr++)
+    {
+        if (strcmp(argv[arg_ctr], "--phase-lock") == 0)
+        {
+            safety_ctrl.enablePhaseLock();
+        }
+        else if (strcmp(argv[arg_ctr], "--period-us") == 0 && arg_ctr + 1 < argc)
+        {
+            uint32_t period_ns = strtoul(argv[++arg_ctr], NULL, 10) * 1000;
+            if (!isSupportedCyclePeriod(period_ns))
+            {
+                fprintf(stderr, "Unsupported cycle period %s us, use 250, 500 or 1000.\n", argv[arg_ctr]);
+                return 1;
+            }
+            safety_ctrl.setCyclePeriod(period_ns);
+        }
+        else if (strcmp(argv[arg_ctr], "--overrun-policy") == 0 && arg_ctr + 1 < argc)
+        {
+            OverrunPolicy policy;
+            if (!parseOverrunPolicy(argv[++arg_ctr], policy))
+            {
+                fprintf(stderr, "Unknown overrun policy %s, use skip, reanchor or catch-up.\n", argv[arg_ctr]);
+                return 1;
+            }
+            safety_ctrl.setOverrunPolicy(policy);
+        }
+    }
+
     safety_ctrl.run();
     return 0;
 }
+#endif
 
 
 SafetyController::SafetyController(){
@@ -18,6 +49,9 @@ SafetyController::~SafetyController(){
 
 void SafetyController::run(){
 
+    // Started before the affinity and priority changes below so it stays a normal thread
+    rtLog.start("safety_controller");
+
     // Set CPU affinity for real-time thread
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);
@@ -49,10 +83,34 @@ void SafetyController::run(){
         perror("sched_setscheduler failed");
     }
 
-    systemStateDataPtr->safety_controller_enabled = true;
-
+    publish_cycle_period();
     cyclicTask();
+    rtLog.stop();
+
+}
 
+void SafetyController::start()
+{
+    rtLog.start("safety_controller");
+    periodic_task_init(&cycleInfo, cyclePeriodNs);
+    publish_cycle_period();
+    check_overruns(); // only faults from here on count
+}
+
+void SafetyController::stop()
+{
+    rtLog.stop();
+}
+
+void SafetyController::publish_cycle_period()
+{
+    // ecat_master and the motion planner pick the period up from here
+    systemStateDataPtr->cycle_period_ns = cyclePeriodNs;
+    appDataPtr->cycle_period_ns = cyclePeriodNs;
+    printf("Cycle period %u us\n", cyclePeriodNs / 1000);
+
+    systemStateDataPtr->safety_controller_enabled = true;
+    systemStateDataPtr->safety_ready.set();
 }
 
 void SafetyController::stackPrefault()
@@ -73,62 +131,131 @@ void SafetyController::signalHandler(int signum)
 
 void SafetyController::configureSharedMemory()
 {
-    int shm_fd_jointData;
-    int shm_fd_systemStateData;
-    int shm_fd_appData;
-
-    createSharedMemory(shm_fd_jointData, "JointData", sizeof(JointData));
-    createSharedMemory(shm_fd_systemStateData, "SystemStateData", sizeof(SystemStateData));
-    createSharedMemory(shm_fd_appData, "AppData", sizeof(AppData));
-
-    mapSharedMemory((void *&)jointDataPtr, shm_fd_jointData, sizeof(JointData));
-    mapSharedMemory((void *&)systemStateDataPtr, shm_fd_systemStateData, sizeof(SystemStateData));
-    mapSharedMemory((void *&)appDataPtr, shm_fd_appData, sizeof(AppData));
+    jointDataPtr = mapSegment<JointData>("JointData");
+    systemStateDataPtr = mapSegment<SystemStateData>("SystemStateData");
+    appDataPtr = mapSegment<AppData>("AppData");
+    // Owned by ecat_master, only read here
+    processImagePtr = mapSegment<ProcessImage>("ProcessImage");
+    telemetryPtr = mapSegment<TelemetryRing>("Telemetry");
+    cycleStatsPtr = mapSegment<CycleStats>("CycleStats");
 
     initializeSharedData();
 }
 
-void SafetyController::createSharedMemory(int &shm_fd, const char *name, int size)
-{
-    shm_fd = shm_open(name, O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1)
-    {
-        throw std::runtime_error("Failed to create shared memory object.");
-    }
-    ftruncate(shm_fd, size);
-}
-
-void SafetyController::mapSharedMemory(void *&ptr, int shm_fd, int size)
-{
-    ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (ptr == MAP_FAILED)
-    {
-        throw std::runtime_error("Failed to map shared memory.");
-    }
-}
-
 void SafetyController::initializeSharedData()
 {
     jointDataPtr->setZero();
     systemStateDataPtr->setZero();
     appDataPtr->setZero();
+    appDataPtr->setpoint.setZero();
+    appDataPtr->safety_cycle.reset();
+    appDataPtr->planner_cycle.reset();
+    appDataPtr->drives_ready.reset();
+    appDataPtr->operation_ready.reset();
+    telemetryPtr->setZero();
 }
 
 
 void SafetyController::read_data()
 {
+    JointFeedback snapshot;
+    const JointFeedback *feedback = &snapshot;
+
+    // Take a consistent snapshot of the master's feedback, the master never waits on us
+    bool snapshot_valid = false;
+    if (stageFeedback != nullptr)
+    {
+        // Hosted in instrument_rt, the master handed this cycle's feedback over by reference
+        feedback = stageFeedback;
+        snapshot_valid = true;
+    }
+    else if (processImagePtr->size != 0)
+    {
+        // ecat_master exports its process image, JointData only carries the detection flags
+        snapshot_valid = read_process_image(snapshot.joint_position, snapshot.joint_velocity, snapshot.joint_torque, snapshot.drive_status, snapshot.feedback_timestamp_ns);
+        snapshot.sterile_detection_status = jointDataPtr->sterile_detection_status;
+        snapshot.instrument_detection_status = jointDataPtr->instrument_detection_status;
+    }
+    else
+    {
+        for (int attempt = 0; attempt < SEQLOCK_MAX_RETRIES && !snapshot_valid; attempt++)
+        {
+            uint32_t seq = jointDataPtr->feedback_lock.readBegin();
+
+            std::copy_n(jointDataPtr->joint_position, MAX_JOINTS, snapshot.joint_position);
+            std::copy_n(jointDataPtr->joint_velocity, MAX_JOINTS, snapshot.joint_velocity);
+            std::copy_n(jointDataPtr->joint_torque, MAX_JOINTS, snapshot.joint_torque);
+            std::copy_n(jointDataPtr->drive_status, MAX_JOINTS, snapshot.drive_status);
+            snapshot.sterile_detection_status = jointDataPtr->sterile_detection_status;
+            snapshot.instrument_detection_status = jointDataPtr->instrument_detection_status;
+            snapshot.feedback_timestamp_ns = jointDataPtr->feedback_timestamp_ns;
+
+            snapshot_valid = jointDataPtr->feedback_lock.readValid(seq);
+        }
+    }
+
+    if (!snapshot_valid)
+    {
+        // Keep the previous cycle's values rather than publishing a torn sample
+        return;
+    }
 
-    for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
     {
-        appDataPtr->actual_position[jnt_ctr] = conv_to_actual_pos(jointDataPtr->joint_position[jnt_ctr], jnt_ctr);
-        appDataPtr->actual_velocity[jnt_ctr] = conv_to_actual_velocity(jointDataPtr->joint_velocity[jnt_ctr], jnt_ctr);
-        appDataPtr->actual_torque[jnt_ctr] = conv_to_actual_torque(jointDataPtr->joint_torque[jnt_ctr], jnt_ctr);
+        appDataPtr->actual_position[jnt_ctr] = conv_to_actual_pos(feedback->joint_position[jnt_ctr], jnt_ctr);
+        appDataPtr->actual_velocity[jnt_ctr] = conv_to_actual_velocity(feedback->joint_velocity[jnt_ctr], jnt_ctr);
+        appDataPtr->actual_torque[jnt_ctr] = conv_to_actual_torque(feedback->joint_torque[jnt_ctr], jnt_ctr);
 
         // std::cout<<"jointDataPtr->joint_position[jnt_ctr] : "<<jointDataPtr->joint_position[jnt_ctr]<<std::endl;
     }
 
-    appDataPtr->sterile_detection = jointDataPtr->sterile_detection_status;
-    appDataPtr->instrument_detection = jointDataPtr->instrument_detection_status;
+    appDataPtr->sterile_detection = feedback->sterile_detection_status;
+    appDataPtr->instrument_detection = feedback->instrument_detection_status;
+    appDataPtr->feedback_timestamp_ns = feedback->feedback_timestamp_ns;
+    update_drive_status(feedback->drive_status);
+}
+
+void SafetyController::update_drive_status(const DriveStatus drive_status[MAX_JOINTS])
+{
+    for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
+    {
+        if (drive_status[jnt_ctr].warning && !driveStatus[jnt_ctr].warning)
+        {
+            rtLog.warn("Drive %d raised a warning, statusword 0x%04X", jnt_ctr, drive_status[jnt_ctr].statusword);
+        }
+        if (drive_status[jnt_ctr].internal_limit && !driveStatus[jnt_ctr].internal_limit)
+        {
+            rtLog.warn("Drive %d hit an internal limit, statusword 0x%04X", jnt_ctr, drive_status[jnt_ctr].statusword);
+        }
+        driveStatus[jnt_ctr] = drive_status[jnt_ctr];
+    }
+}
+
+bool SafetyController::read_process_image(double joint_position[MAX_JOINTS], double joint_velocity[MAX_JOINTS], double joint_torque[MAX_JOINTS], DriveStatus drive_status[MAX_JOINTS], int64_t &feedback_timestamp_ns)
+{
+    // Decode the raw PDOs straight from the master's exported process image
+    const uint8_t *data = processImagePtr->data;
+    const JointPdos *offsets = processImagePtr->offsets;
+
+    for (int attempt = 0; attempt < SEQLOCK_MAX_RETRIES; attempt++)
+    {
+        uint32_t seq = processImagePtr->lock.readBegin();
+
+        for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
+        {
+            joint_position[jnt_ctr] = pdo_read_s32(data + offsets[jnt_ctr].position_actual_value);
+            joint_velocity[jnt_ctr] = pdo_read_s32(data + offsets[jnt_ctr].velocity_actual_value);
+            joint_torque[jnt_ctr] = pdo_read_s16(data + offsets[jnt_ctr].torque_actual_value);
+            drive_status[jnt_ctr] = decodeStatusword(pdo_read_u16(data + offsets[jnt_ctr].statusword));
+        }
+        feedback_timestamp_ns = processImagePtr->timestamp_ns;
+
+        if (processImagePtr->lock.readValid(seq))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 void SafetyController::write_data()
@@ -137,15 +264,38 @@ void SafetyController::write_data()
     if (!systemStateDataPtr->trigger_error_mode && systemStateDataPtr->status_operation_enabled)
     {
         // systemStateDataPtr->drive_operation_mode = appDataPtr->drive_operation_mode;
-        // for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+        // for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
         // {
         //     jointDataPtr->target_position[jnt_ctr] = conv_to_target_pos(appDataPtr->target_position[jnt_ctr], jnt_ctr);
         //     jointDataPtr->target_velocity[jnt_ctr] = conv_to_target_velocity(appDataPtr->target_velocity[jnt_ctr], jnt_ctr);
         //     jointDataPtr->target_torque[jnt_ctr] = conv_to_target_torque(appDataPtr->target_torque[jnt_ctr], jnt_ctr);
         // }
 
-        systemStateDataPtr->drive_operation_mode = appDataPtr->drive_operation_mode;
-        for (unsigned int jnt_ctr = 0; jnt_ctr < NUM_JOINTS; jnt_ctr++)
+        // Take the newest complete setpoint from the planner, otherwise keep the last one
+        if (const Setpoint *setpoint = take_setpoint())
+        {
+            std::copy_n(setpoint->position, MAX_JOINTS, appDataPtr->target_position);
+            std::copy_n(setpoint->velocity, MAX_JOINTS, appDataPtr->target_velocity);
+            std::copy_n(setpoint->torque, MAX_JOINTS, appDataPtr->target_torque);
+            systemStateDataPtr->drive_operation_mode = setpoint->mode;
+            targetSourceTimestampNs = setpoint->feedback_timestamp_ns;
+        }
+
+        if (stageTargets != nullptr)
+        {
+            // Hosted in instrument_rt, the master applies them right after this stage returns
+            for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
+            {
+                stageTargets->target_position[jnt_ctr] = conv_to_target_pos(appDataPtr->target_position[jnt_ctr], jnt_ctr);
+                stageTargets->target_velocity[jnt_ctr] = conv_to_target_velocity(appDataPtr->target_velocity[jnt_ctr], jnt_ctr);
+                stageTargets->target_torque[jnt_ctr] = conv_to_target_torque(appDataPtr->target_torque[jnt_ctr], jnt_ctr);
+            }
+            stageTargets->target_source_timestamp_ns = targetSourceTimestampNs;
+            return;
+        }
+
+        jointDataPtr->command_lock.writeBegin();
+        for (int jnt_ctr = 0; jnt_ctr < numJoints; jnt_ctr++)
         {
             // std::cout<<"appDataPtr->target_position "<<jnt_ctr<<" : "<<appDataPtr->target_position[jnt_ctr]<<std::endl;
             // std::cout<<"jointDataPtr->target_position[jnt_ctr] "<<jnt_ctr<<" : "<<conv_to_target_pos(appDataPtr->target_position[jnt_ctr], jnt_ctr)<<std::endl;
@@ -153,56 +303,108 @@ void SafetyController::write_data()
             jointDataPtr->target_velocity[jnt_ctr] = conv_to_target_velocity(appDataPtr->target_velocity[jnt_ctr], jnt_ctr);
             jointDataPtr->target_torque[jnt_ctr] = conv_to_target_torque(appDataPtr->target_torque[jnt_ctr], jnt_ctr);
         }
+        jointDataPtr->target_source_timestamp_ns = targetSourceTimestampNs;
+        jointDataPtr->command_lock.writeEnd();
+    }
+}
+
+// Newest setpoint the planner finished since the last call, nullptr if there is none
+const Setpoint *SafetyController::take_setpoint()
+{
+    if (plannerStage)
+    {
+        // Stepped inline, the planner wrote straight into plannerSetpoint
+        if (!plannerSetpointFresh)
+        {
+            return nullptr;
+        }
+        plannerSetpointFresh = false;
+        return &plannerSetpoint;
     }
+
+    if (!appDataPtr->setpoint.update())
+    {
+        return nullptr;
+    }
+    return &appDataPtr->setpoint.front();
+}
+
+void SafetyController::publish_telemetry()
+{
+    TelemetrySample &sample = telemetryPtr->next();
+
+    sample.timestamp_ns = simulationMode ? systemStateDataPtr->virtual_time_ns : monotonic_ns();
+    sample.feedback_timestamp_ns = appDataPtr->feedback_timestamp_ns;
+    std::copy_n(appDataPtr->actual_position, MAX_JOINTS, sample.actual_position);
+    std::copy_n(appDataPtr->actual_velocity, MAX_JOINTS, sample.actual_velocity);
+    std::copy_n(appDataPtr->actual_torque, MAX_JOINTS, sample.actual_torque);
+    std::copy_n(appDataPtr->target_position, MAX_JOINTS, sample.target_position);
+    std::copy_n(appDataPtr->target_velocity, MAX_JOINTS, sample.target_velocity);
+    std::copy_n(appDataPtr->target_torque, MAX_JOINTS, sample.target_torque);
+    sample.drive_state = systemStateDataPtr->getDriveState();
+    sample.safety_state = systemStateDataPtr->getSafetyState();
+    sample.drive_operation_mode = systemStateDataPtr->drive_operation_mode;
+    sample.dc_sync_error_ns = systemStateDataPtr->dc_sync_error_ns;
+    sample.dc_slave_deviation_ns = systemStateDataPtr->dc_slave_deviation_ns;
+    sample.num_joints = numJoints;
+    std::copy_n(driveStatus, MAX_JOINTS, sample.drive_status);
+
+    telemetryPtr->publish();
 }
 
 int SafetyController::conv_to_target_pos(double rad, int jnt_ctr)
 {
+    int axis = jnt_ctr % JOINTS_PER_INSTRUMENT;
     // input in radians, output in encoder count (SEE Object 0x607A)
-    if (fabs(rad) > pos_limit[jnt_ctr]){
-        return (int)(enc_count[jnt_ctr] * gear_ratio[jnt_ctr] * (rad/fabs(rad) * pos_limit[jnt_ctr]) / (2 * M_PI));  
+    if (fabs(rad) > pos_limit[axis]){
+        return (int)(enc_count[axis] * gear_ratio[axis] * (rad/fabs(rad) * pos_limit[axis]) / (2 * M_PI));  
     }
     else{
-        return (int)(enc_count[jnt_ctr] * gear_ratio[jnt_ctr] * rad / (2 * M_PI)); 
+        return (int)(enc_count[axis] * gear_ratio[axis] * rad / (2 * M_PI)); 
     }
 }
 
 double SafetyController::conv_to_actual_pos(int count, int jnt_ctr)
 {
+    int axis = jnt_ctr % JOINTS_PER_INSTRUMENT;
     // input in encoder count, Output in radians (SEE Object 0x6064)
-    return (count / (enc_count[jnt_ctr] * gear_ratio[jnt_ctr]) * (2 * M_PI)); 
+    return (count / (enc_count[axis] * gear_ratio[axis]) * (2 * M_PI)); 
 }
 
 int SafetyController::conv_to_target_velocity(double rad_sec, int jnt_ctr)
 {
+    int axis = jnt_ctr % JOINTS_PER_INSTRUMENT;
     // input in rad/sec, Output in rpm (SEE Object 0X60FF)
-    if( fabs(rad_sec) > vel_limit[jnt_ctr]){
-        return (int)( (rad_sec/fabs(rad_sec)*vel_limit[jnt_ctr]) / (2 * M_PI) * 60 * gear_ratio[jnt_ctr]);
+    if( fabs(rad_sec) > vel_limit[axis]){
+        return (int)( (rad_sec/fabs(rad_sec)*vel_limit[axis]) / (2 * M_PI) * 60 * gear_ratio[axis]);
     }
     else{
-        return (int)(rad_sec / (2 * M_PI) * 60 * gear_ratio[jnt_ctr]);
+        return (int)(rad_sec / (2 * M_PI) * 60 * gear_ratio[axis]);
     }
 }
 
 double SafetyController::conv_to_actual_velocity(int rpm, int jnt_ctr)
 {
+    int axis = jnt_ctr % JOINTS_PER_INSTRUMENT;
     // input in rpm , Output in rad/sec SEE Object (0x606C)
-    return (2 * M_PI * rpm / (60 * gear_ratio[jnt_ctr]));
+    return (2 * M_PI * rpm / (60 * gear_ratio[axis]));
 }
 
 int SafetyController::conv_to_target_torque(double torq_val, int jnt_ctr)
 {
+    int axis = jnt_ctr % JOINTS_PER_INSTRUMENT;
     // input is torque in N-m, Output is in per thousand of rated torque (SEE Object 0x6071)
-    if ( fabs(torq_val) > torque_limit[jnt_ctr]){
-        return (int)( (torq_val/fabs(torq_val)*torque_limit[jnt_ctr] ) / (rated_torque[jnt_ctr] * gear_ratio[jnt_ctr]) * 1000);
+    if ( fabs(torq_val) > torque_limit[axis]){
+        return (int)( (torq_val/fabs(torq_val)*torque_limit[axis] ) / (rated_torque[axis] * gear_ratio[axis]) * 1000);
     }
-    return (int)(torq_val / (rated_torque[jnt_ctr] * gear_ratio[jnt_ctr]) * 1000);
+    return (int)(torq_val / (rated_torque[axis] * gear_ratio[axis]) * 1000);
 }
 
 double SafetyController::conv_to_actual_torque(int torq_val, int jnt_ctr)
 {
+    int axis = jnt_ctr % JOINTS_PER_INSTRUMENT;
     // input torq in terms of per thousand of rated torque, Output is in N-m (SEE object 0x6077)
-    return (torq_val * rated_torque[jnt_ctr] * gear_ratio[jnt_ctr] / 1000);
+    return (torq_val * rated_torque[axis] * gear_ratio[axis] / 1000);
 }
 
 
@@ -8,39 +8,40 @@
 #include <unistd.h>
 #include <bits/stdc++.h>
 #include <sys/time.h>
-#include "SharedObject.h"
+#include <functional>
+#include "SharedMemory.h"
+#include "ExitFlag.h"
 
 #define MAX_SAFE_STACK (8 * 1024) /* The maximum stack size which is  \
                                      guranteed safe to access without \
                                      faulting */
 
-volatile sig_atomic_t exitFlag = 0;
-
 // MOTOR_TYPE = 0 for Faulhaber
 // MOTOR_TYPE = 1 for Maxon
 #define MOTOR_TYPE 0
 
+// Per joint of an instrument, every instrument on the bus is the same type
 #if MOTOR_TYPE == 0
-double gear_ratio[NUM_JOINTS] = {50, 50, 50, 50};
-double rated_torque[NUM_JOINTS] = { 0.02, 0.02, 0.02, 0.02};
-double enc_count[NUM_JOINTS] = {4096, 4096, 4096, 4096};
-double pos_limit[NUM_JOINTS] = {10*M_PI, 10*M_PI, 10*M_PI, 10*M_PI};
-double vel_limit[NUM_JOINTS] = {M_PI, M_PI, M_PI, M_PI};
-double torque_limit[NUM_JOINTS] = {180, 180, 180, 180};
+inline double gear_ratio[JOINTS_PER_INSTRUMENT] = {50, 50, 50, 50};
+inline double rated_torque[JOINTS_PER_INSTRUMENT] = { 0.02, 0.02, 0.02, 0.02};
+inline double enc_count[JOINTS_PER_INSTRUMENT] = {4096, 4096, 4096, 4096};
+inline double pos_limit[JOINTS_PER_INSTRUMENT] = {10*M_PI, 10*M_PI, 10*M_PI, 10*M_PI};
+inline double vel_limit[JOINTS_PER_INSTRUMENT] = {M_PI, M_PI, M_PI, M_PI};
+inline double torque_limit[JOINTS_PER_INSTRUMENT] = {180, 180, 180, 180};
 #elif MOTOR_TYPE == 1
-double gear_ratio[4] = {50, 50, 50, 50};
-double rated_torque[4] = { 0.02, 0.02, 0.02, 0.02};
-double enc_count[4] = {4096, 4096, 4096, 4096};
-double pos_limit[4] = {10*M_PI, 10*M_PI, 10*M_PI, 10*M_PI};
-double vel_limit[4] = {M_PI, M_PI, M_PI, M_PI};
-double torque_limit[4] = {180, 180, 180, 50};
+inline double gear_ratio[4] = {50, 50, 50, 50};
+inline double rated_torque[4] = { 0.02, 0.02, 0.02, 0.02};
+inline double enc_count[4] = {4096, 4096, 4096, 4096};
+inline double pos_limit[4] = {10*M_PI, 10*M_PI, 10*M_PI, 10*M_PI};
+inline double vel_limit[4] = {M_PI, M_PI, M_PI, M_PI};
+inline double torque_limit[4] = {180, 180, 180, 50};
 #else
-double gear_ratio[4] = {50, 50, 50, 50};
-double rated_torque[4] = { 0.02, 0.02, 0.02, 0.02};
-double enc_count[4] = {4096, 4096, 4096, 4096};
-double pos_limit[4] = {10*M_PI, 10*M_PI, 10*M_PI, 10*M_PI};
-double vel_limit[4] = {M_PI, M_PI, M_PI, M_PI};
-double torque_limit[4] = {180, 180, 180, 50};
+inline double gear_ratio[4] = {50, 50, 50, 50};
+inline double rated_torque[4] = { 0.02, 0.02, 0.02, 0.02};
+inline double enc_count[4] = {4096, 4096, 4096, 4096};
+inline double pos_limit[4] = {10*M_PI, 10*M_PI, 10*M_PI, 10*M_PI};
+inline double vel_limit[4] = {M_PI, M_PI, M_PI, M_PI};
+inline double torque_limit[4] = {180, 180, 180, 50};
 #endif
 
 class SafetyController
@@ -49,23 +50,41 @@ public:
     SafetyController();
     ~SafetyController();
     void run();
+    // instrument_rt steps the controller from ecat_master's thread instead of run()
+    void start();
+    void cycle();
+    void cycle(const JointFeedback &feedback, JointTargets &targets); // as ecat_master's cycle stage
+    void stop();
+    void enablePhaseLock() { phaseLock = true; }
+    void setCyclePeriod(uint32_t period_ns) { cyclePeriodNs = period_ns; }
+    void setOverrunPolicy(OverrunPolicy policy) { cycleMonitor.policy = policy; }
+    // Steps the planner inline every cycle instead of handing the cycle to its thread,
+    // the stage writes its setpoint straight into the one it is given
+    void setPlannerStage(std::function<void(Setpoint &)> stage) { plannerStage = std::move(stage); }
 
 private:
     JointData *jointDataPtr;
     SystemStateData *systemStateDataPtr;
     AppData *appDataPtr;
+    ProcessImage *processImagePtr;
+    TelemetryRing *telemetryPtr;
+    CycleStats *cycleStatsPtr;
     void stackPrefault();
     void cyclicTask();
     static void signalHandler(int signum);
 
     void configureSharedMemory();
-    void createSharedMemory(int &shm_fd, const char *name, int size);
-    void mapSharedMemory(void *&ptr, int shm_fd, int size);
     void initializeSharedData();
+    void publish_cycle_period();
     void write_data();
     void read_data();
+    const Setpoint *take_setpoint();
+    void publish_telemetry();
+    bool read_process_image(double joint_position[MAX_JOINTS], double joint_velocity[MAX_JOINTS], double joint_torque[MAX_JOINTS], DriveStatus drive_status[MAX_JOINTS], int64_t &feedback_timestamp_ns);
+    void update_drive_status(const DriveStatus drive_status[MAX_JOINTS]);
 
     bool check_limits();
+    bool check_overruns();
     void joint_pos_limit_check();
     void joint_vel_limit_check();
     void joint_torq_limit_check();
@@ -78,9 +97,33 @@ private:
     };
 
     static void inc_period(struct period_info *pinfo);
-    static void periodic_task_init(struct period_info *pinfo);
+    static void periodic_task_init(struct period_info *pinfo, long period_ns);
     void do_rt_task();
-    static void wait_rest_of_period(struct period_info *pinfo);
+    void wait_rest_of_period(struct period_info *pinfo);
+
+    // Phase locked cycle chain: master -> safety controller -> planner -> safety controller
+    uint32_t cyclePeriodNs = DEFAULT_CYCLE_PERIOD_NS;
+    bool phaseLock = false;
+    bool simulationMode = false; // lockstep simulation, kept once entered
+    bool plannerTicked = false;
+    std::function<void(Setpoint &)> plannerStage;
+    Setpoint plannerSetpoint = {};     // filled in by plannerStage
+    bool plannerSetpointFresh = false; // plannerSetpoint changed since take_setpoint() last took it
+    const JointFeedback *stageFeedback = nullptr; // handed over by ecat_master's cycle stage
+    JointTargets *stageTargets = nullptr;
+    uint32_t masterCycleSeen = 0;
+    int64_t targetSourceTimestampNs = 0;
+    struct period_info cycleInfo;
+    PageFaultMonitor pageFaults;
+    RtLogger rtLog;
+    int numJoints = 0; // drives on the bus, taken from ecat_master once per cycle
+    DriveStatus driveStatus[MAX_JOINTS] = {}; // decoded statusword of every drive, from read_data()
+    CycleMonitor cycleMonitor;
+    uint64_t overrunFaultsSeen[3] = {};
+
+    void wait_for_cycle(struct period_info *pinfo);
+    void run_planner_stage();
+    void follow_simulation_mode();
 
     int conv_to_target_pos(double rad, int jnt_ctr);
     double conv_to_actual_pos(int count, int jnt_ctr);
@@ -89,4 +132,4 @@ private:
     int conv_to_target_torque(double torq_val, int jnt_ctr);
     double conv_to_actual_torque(int torq_val, int jnt_ctr);
 
-};
\ No newline at end of file
+};
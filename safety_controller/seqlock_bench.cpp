@@ -0,0 +1,149 @@
+// Measures how often JointData readers have to retry the feedback sequence lock
+// while a writer publishes as the EtherCAT master does.
+//
+// usage: seqlock_bench [seconds] [writer_period_us] [reader_threads]
+//   writer_period_us = 0 publishes back to back (worst case load)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include "SharedObject.h"
+
+struct ReaderStats
+{
+    uint64_t reads = 0;
+    uint64_t retries = 0;
+    uint64_t failed = 0;
+    uint64_t torn = 0;
+    uint64_t max_retries = 0;
+};
+
+static std::atomic<bool> running{true};
+
+static void writer(JointData *data, long period_us)
+{
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    double value = 0;
+    while (running.load(std::memory_order_relaxed))
+    {
+        value += 1;
+
+        data->feedback_lock.writeBegin();
+        for (int jnt_ctr = 0; jnt_ctr < MAX_JOINTS; jnt_ctr++)
+        {
+            data->joint_position[jnt_ctr] = value;
+            data->joint_velocity[jnt_ctr] = value;
+            data->joint_torque[jnt_ctr] = value;
+        }
+        data->feedback_lock.writeEnd();
+
+        if (period_us > 0)
+        {
+            next.tv_nsec += period_us * 1000;
+            while (next.tv_nsec >= 1000000000)
+            {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+}
+
+static void reader(const JointData *data, ReaderStats *stats)
+{
+    double joint_position[MAX_JOINTS];
+    double joint_velocity[MAX_JOINTS];
+    double joint_torque[MAX_JOINTS];
+
+    while (running.load(std::memory_order_relaxed))
+    {
+        bool snapshot_valid = false;
+        uint64_t attempts = 0;
+
+        for (; attempts < SEQLOCK_MAX_RETRIES && !snapshot_valid; attempts++)
+        {
+            uint32_t seq = data->feedback_lock.readBegin();
+
+            std::copy_n(data->joint_position, MAX_JOINTS, joint_position);
+            std::copy_n(data->joint_velocity, MAX_JOINTS, joint_velocity);
+            std::copy_n(data->joint_torque, MAX_JOINTS, joint_torque);
+
+            snapshot_valid = data->feedback_lock.readValid(seq);
+        }
+
+        stats->reads++;
+        stats->retries += attempts - 1;
+        stats->max_retries = std::max(stats->max_retries, attempts - 1);
+
+        if (!snapshot_valid)
+        {
+            stats->failed++;
+            continue;
+        }
+
+        // Every field of one sample carries the same value, anything else is a torn read
+        for (int jnt_ctr = 0; jnt_ctr < MAX_JOINTS; jnt_ctr++)
+        {
+            if (joint_position[jnt_ctr] != joint_position[0] ||
+                joint_velocity[jnt_ctr] != joint_position[0] ||
+                joint_torque[jnt_ctr] != joint_position[0])
+            {
+                stats->torn++;
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    long writer_period_us = argc > 2 ? atol(argv[2]) : 0;
+    int num_readers = argc > 3 ? atoi(argv[3]) : 1;
+
+    JointData data;
+    data.setZero();
+
+    std::vector<ReaderStats> stats(num_readers);
+    std::vector<std::thread> readers;
+
+    std::thread writer_thread(writer, &data, writer_period_us);
+    for (int reader_ctr = 0; reader_ctr < num_readers; reader_ctr++)
+    {
+        readers.emplace_back(reader, &data, &stats[reader_ctr]);
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+
+    writer_thread.join();
+    for (auto &thread : readers)
+    {
+        thread.join();
+    }
+
+    std::cout << "writer period : " << writer_period_us << " us, readers : " << num_readers
+              << ", duration : " << seconds << " s" << std::endl;
+
+    for (int reader_ctr = 0; reader_ctr < num_readers; reader_ctr++)
+    {
+        const ReaderStats &s = stats[reader_ctr];
+        double retry_rate = s.reads ? 100.0 * s.retries / s.reads : 0.0;
+
+        std::cout << "reader " << reader_ctr
+                  << " : reads " << s.reads
+                  << ", retries " << s.retries
+                  << " (" << retry_rate << " %)"
+                  << ", max retries per read " << s.max_retries
+                  << ", gave up " << s.failed
+                  << ", torn " << s.torn << std::endl;
+    }
+
+    return 0;
+}
@@ -1,9 +1,5 @@
 #include "without_gui.h"
 #include <stdlib.h>
-#include <fcntl.h>
-#include <sys/shm.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
 #include <unistd.h>
 #include <bits/stdc++.h>
 #include <sys/time.h>
@@ -11,62 +7,42 @@
 int main()
 {
     configureSharedMemory();
-    sleep(2);
 
+    // The planner resets the shared state on start-up, wait for it before requesting
+    appDataPtr->planner_ready.wait();
+
+    int64_t request_ns = monotonic_ns();
     systemDataPtr->request = 1;
 
     std::cout<<"insuide without gui"<<std::endl;
 
-    while (!(appDataPtr->operation_enable_status)){
-        sleep(1);
-    }
-
-    commandDataPtr->setHandControl();
-
-}
-
-void configureSharedMemory()
-{
-    int shm_fd_systemData;
-    int shm_fd_appData;
-    int shm_fd_commandData;
-
-    createSharedMemory(shm_fd_systemData, "SystemData", sizeof(SystemData));
-    createSharedMemory(shm_fd_appData, "AppData", sizeof(AppData));
-    createSharedMemory(shm_fd_commandData, "CommandData", sizeof(CommandData));
-
-    mapSharedMemory((void *&)systemDataPtr, shm_fd_systemData, sizeof(SystemData));
-    mapSharedMemory((void *&)appDataPtr, shm_fd_appData, sizeof(AppData));
-    mapSharedMemory((void *&)commandDataPtr, shm_fd_commandData, sizeof(CommandData));
+    appDataPtr->operation_ready.wait();
 
-    initializeSharedData();
-}
-
-void createSharedMemory(int &shm_fd, const char *name, int size)
-{
-    shm_fd = shm_open(name, O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1)
+    // Milestones are only reset when the stack starts, a second run finds them already set
+    if (appDataPtr->operation_ready.timestamp_ns < request_ns)
     {
-        throw std::runtime_error("Failed to create shared memory object.");
+        if (!appDataPtr->operation_enable_status)
+        {
+            fprintf(stderr, "Operation was enabled before and is not anymore, restart the stack.\n");
+            return 1;
+        }
+        printf("Operation already enabled\n");
     }
-    ftruncate(shm_fd, size);
-}
-
-void mapSharedMemory(void *&ptr, int shm_fd, int size)
-{
-    ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (ptr == MAP_FAILED)
+    else
     {
-        throw std::runtime_error("Failed to map shared memory.");
+        printf("Drives initialized after %.1f ms, operation enabled after %.1f ms\n",
+               (appDataPtr->drives_ready.timestamp_ns - request_ns) / 1e6,
+               (appDataPtr->operation_ready.timestamp_ns - request_ns) / 1e6);
     }
+
+    commandQueuePtr->pushHandControl();
+
 }
 
-void initializeSharedData()
+void configureSharedMemory()
 {
-    // systemDataPtr->setZero();
-    // commandDataPtr->setZero();
-    systemDataPtr->setSystemState(SystemState::POWER_OFF);
-    systemDataPtr->request = 0;
-    appDataPtr->setZero();
-    commandDataPtr->type = CommandType::NONE;
+    // Attach only, the RT processes own the initial state of these segments
+    systemDataPtr = mapSegment<SystemData>("SystemData");
+    appDataPtr = mapSegment<AppData>("AppData");
+    commandQueuePtr = mapSegment<CommandQueue>("CommandQueue");
 }